@@ -2,6 +2,8 @@
 
 #include <random>
 
+#include "core/timed.h"
+
 namespace cgo::_impl {
 
 void BaseMsg::Simplex::commit() {
@@ -188,6 +190,17 @@ void Select::on(int key, Select::Default) {
   _default_key = key;
 }
 
+void Select::on(int key, Select::Timeout timeout) {
+  if (_timeout_key != InvalidSelectKey) {
+    throw std::runtime_error("select already has a timeout case");
+  }
+  if (key == InvalidSelectKey) {
+    throw std::runtime_error("key not allowed");
+  }
+  _timeout_key = key;
+  _timeout = timeout;
+}
+
 Coroutine<int> Select::operator()() {
   std::minstd_rand rng;
   std::shuffle(_listeners.begin(), this->_listeners.end(), rng);
@@ -201,6 +214,20 @@ Coroutine<int> Select::operator()() {
 
   auto guard = defer([this]() { _drop(); });
   if (_default_key == InvalidSelectKey) {
+    _impl::TimedContext::Handle timer;
+    if (_timeout_key != InvalidSelectKey && _key == InvalidSelectKey) {
+      auto& ctx = this_coroutine_ctx();
+      timer = _impl::TimedContext::at(ctx).create_timeout(
+          [this]() {
+            std::unique_lock guard(_mtx);
+            if (_key == InvalidSelectKey) {
+              _key = _timeout_key;
+              _signal.release();
+            }
+          },
+          _timeout.duration, _timeout.slack);
+    }
+    auto timer_guard = defer([&timer]() { timer.cancel(); });
     co_await _signal.aquire();
     std::unique_lock guard(_mtx);
     co_return _key;
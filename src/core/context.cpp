@@ -12,18 +12,24 @@ auto TimedContext::at(Context& ctx) -> TimedContext& { return *ctx._timed_ctx; }
 
 auto EventContext::at(Context& ctx) -> EventContext& { return *ctx._event_ctx; }
 
+auto UringContext::at(Context& ctx) -> UringContext* { return ctx._uring_ctx.get(); }
+
 }  // namespace cgo::_impl
 
 namespace cgo {
 
-void Context::startup(size_t n_worker) {
+void Context::startup(size_t n_worker, const ContextOptions& options) {
   if (_finished) {
     throw std::runtime_error("restart context");
   }
+  _options = options;
   _barrier = std::make_unique<std::barrier<>>(n_worker);
   _sched_ctx = std::make_unique<_impl::SchedContext>(*this, n_worker);
-  _timed_ctx = std::make_unique<_impl::TimedContext>(n_worker);
+  _timed_ctx = std::make_unique<_impl::TimedContext>(n_worker, options.timer_backend, options.timer_tick);
   _event_ctx = std::make_unique<_impl::EventContext>(n_worker);
+  if (options.io_backend == IoBackend::Uring && _impl::Uring::supported()) {
+    _uring_ctx = std::make_unique<_impl::UringContext>(n_worker);
+  }
   for (int i = 0; i < n_worker; ++i) {
     _workers.emplace_back(&Context::_run, this, i);
   }
@@ -34,24 +40,42 @@ void Context::shutdown() {
     return;
   }
   _finished = true;
+  if (_sched_ctx) {
+    _sched_ctx->unpark_all();
+  }
   for (auto& worker : _workers) {
     if (worker.joinable()) {
       worker.join();
     }
   }
+  if constexpr (_impl::Spinlock::StatsEnabled) {
+    _impl::Spinlock::dump_stats();
+  }
 }
 
 void Context::_run(size_t pindex) {
-  _impl::EventLazySignal signal(*this, /*nowait=*/true);
+  _impl::EventLazySignal signal(*this, pindex);
   _sched_ctx->on_scheduled(pindex, signal);
   _timed_ctx->on_timeout(pindex, signal);
+  auto ring = _uring_ctx ? &_uring_ctx->ring(pindex) : nullptr;
+  if (ring) {
+    // completions wake the worker polling its handler, they are reaped by the loop
+    ring->bind();
+    _event_ctx->handler(pindex).add(ring->fd(), _impl::Event::IN, [](_impl::Event) {});
+  }
   _barrier->arrive_and_wait();
 
-  auto last_handle_time = std::chrono::steady_clock::now();
+  if (!_options.precise_clock) {
+    _impl::LoopClock::attach();
+  }
+  auto last_handle_time = _impl::LoopClock::update();
   while (!_finished) {
+    _impl::LoopClock::update();
     bool sched_flag = false;
     if (_sched_ctx->run_scheduled(pindex, 128) > 0) {
       sched_flag = true;
+      // the batch may have run for a while, don't expire timers against a stale time
+      _impl::LoopClock::update();
     }
 
     bool timed_flag = false;
@@ -59,22 +83,45 @@ void Context::_run(size_t pindex) {
       timed_flag = true;
     }
 
-    auto now = std::chrono::steady_clock::now();
+    // SQEs queued by the tasks above go in one submission
+    bool io_flag = false;
+    if (ring && ring->run(128) > 0) {
+      io_flag = true;
+    }
+
+    auto now = _impl::LoopClock::now();
     auto next_sched_time = _timed_ctx->next_schedule_time(pindex);
-    if (sched_flag || timed_flag || now >= next_sched_time) {
+    if (sched_flag || timed_flag || io_flag || now >= next_sched_time) {
       if (now - last_handle_time < std::chrono::milliseconds(1)) {
         continue;
       }
       _event_ctx->run_handler(pindex, 128, std::chrono::milliseconds(0));
-      last_handle_time = std::chrono::steady_clock::now();
-    } else {
-      auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(next_sched_time - now);
-      _event_ctx->run_handler(pindex, 128, std::min(timeout, std::chrono::milliseconds(50)));
-      last_handle_time = std::chrono::steady_clock::now();
+      last_handle_time = now;
+      continue;
+    }
+    if (_event_ctx->run_handler(pindex, 128, std::chrono::milliseconds(0)) > 0) {
+      last_handle_time = now;
+      continue;
+    }
+
+    // nothing to run: sleep until the next timer, a new task, or I/O if any fd is registered
+    if (_sched_ctx->park_scheduled(pindex)) {
+      if (!_finished) {
+        signal.wait(std::min<std::chrono::duration<double, std::milli>>(next_sched_time - now, std::chrono::hours(1)));
+      }
+      _sched_ctx->unpark_scheduled(pindex);
     }
+    last_handle_time = _impl::LoopClock::update();
   }
+  _impl::LoopClock::detach();
 
   _barrier->arrive_and_wait();
+  if (ring) {
+    // a request may reference a frame of any worker, all of them are done before frames are destroyed
+    ring->drain();
+    _barrier->arrive_and_wait();
+    _event_ctx->handler(pindex).del(ring->fd());
+  }
   signal.close();
   _sched_ctx->final_schedule(pindex);
 }
@@ -32,6 +32,14 @@ auto BaseFrame::BasePromise::_call_stack_pop() -> BaseFrame::BasePromise* {
   return _entry->_current = next;
 }
 
+auto BaseFrame::BasePromise::_call_stack_return() -> std::coroutine_handle<> {
+  auto next = _call_stack_pop();
+  if (!next) {
+    return std::noop_coroutine();
+  }
+  return next->_onwer->_handler;
+}
+
 void FrameOperator::_call_stack_create(BaseFrame& entry) {
   auto promise = entry._promise;
   promise->_entry = promise->_current = promise;
@@ -49,6 +57,18 @@ void FrameOperator::_call_stack_destroy(BaseFrame& entry) {
   }
 }
 
+#ifdef CGO_SYMMETRIC_TRANSFER
+
+void FrameOperator::_call_stack_execute(BaseFrame& f) {
+  BaseFrame::BasePromise* entry = f._promise->_entry;
+  entry->_current->_onwer->_handler.resume();
+  if (auto& ex = entry->_error; ex && !entry->_current) {
+    std::rethrow_exception(ex);
+  }
+}
+
+#else
+
 void FrameOperator::_call_stack_execute(BaseFrame& f) {
   BaseFrame::BasePromise* entry = f._promise->_entry;
   BaseFrame::BasePromise* next = entry->_current;
@@ -73,4 +93,6 @@ void FrameOperator::_call_stack_execute(BaseFrame& f) {
   } while (next && current != next);
 }
 
+#endif
+
 }  // namespace cgo::_impl
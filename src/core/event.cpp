@@ -1,9 +1,14 @@
 #include "core/event.h"
 
+#include <algorithm>
+
+#include "core/uring.h"
+
 #if defined(linux) || defined(__linux) || defined(__linux__)
 
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #endif
 
@@ -33,91 +38,259 @@ EventContext::Handler::Handler() { _fd = ::epoll_create(1024); }
 
 EventContext::Handler::~Handler() { ::close(_fd); }
 
-void EventContext::Handler::add(int fd, Event on, std::function<void(Event)>&& fn) {
+namespace {
+
+inline uint64_t pack_event_data(int fd, uint32_t generation) { return (uint64_t(generation) << 32) | uint32_t(fd); }
+
+}  // namespace
+
+auto EventContext::Handler::_find(int fd) -> Slot* {
+  if (size_t(fd) % _n_partition != _pindex) {
+    auto it = _strays.find(fd);
+    return it != _strays.end() && it->second.registered ? &it->second : nullptr;
+  }
+  size_t i = size_t(fd) / _n_partition;
+  return i < _slots.size() && _slots[i].registered ? &_slots[i] : nullptr;
+}
+
+auto EventContext::Handler::_slot(int fd) -> Slot& {
+  if (size_t(fd) % _n_partition != _pindex) {
+    return _strays[fd];
+  }
+  size_t i = size_t(fd) / _n_partition;
+  if (i >= _slots.size()) {
+    _slots.resize(std::max(i + 1, _slots.size() * 2));
+  }
+  return _slots[i];
+}
+
+void EventContext::Handler::add(int fd, Event on, Callback&& fn) {
   std::unique_lock guard(_mtx);
+  auto& slot = _slot(fd);
   ::epoll_event ev;
   ev.events = Event::to_linux(on) | ::EPOLLET;
-  int tid = ev.data.u64 = _gid.fetch_add(1);
-
-  _tid_calls[tid] = {fd, on, std::forward<decltype(fn)>(fn)};
-  _fd_tids[fd] = tid;
+  ev.data.u64 = pack_event_data(fd, ++slot.generation);
 
   if (::epoll_ctl(_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    --slot.generation;
     throw std::runtime_error("epoll_ctl add failed");
   }
+  slot.on = on;
+  slot.fn = std::move(fn);
+  if (!slot.registered) {
+    slot.registered = true;
+    _n_fds.fetch_add(1);
+  }
+  if (_signal) {
+    _signal->emit();
+  }
 }
 
-void EventContext::Handler::mod(int fd, Event on, std::function<void(Event)>&& fn) {
+void EventContext::Handler::mod(int fd, Event on, Callback&& fn) {
   std::unique_lock guard(_mtx);
+  auto* found = _find(fd);
+  if (!found) {
+    throw std::runtime_error("epoll_ctl mod failed");
+  }
+  auto& slot = *found;
   ::epoll_event ev;
   ev.events = Event::to_linux(on) | ::EPOLLET;
-  int tid = ev.data.u64 = _gid.fetch_add(1);
-
-  _tid_calls[tid] = {fd, on, std::forward<decltype(fn)>(fn)};
-  _tid_calls.erase(_fd_tids[fd]);
-  _fd_tids[fd] = tid;
+  ev.data.u64 = pack_event_data(fd, ++slot.generation);
 
   if (::epoll_ctl(_fd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+    --slot.generation;
     throw std::runtime_error("epoll_ctl mod failed");
   }
+  slot.on = on;
+  slot.fn = std::move(fn);
 }
 
 void EventContext::Handler::del(int fd) {
   std::unique_lock guard(_mtx);
   ::epoll_ctl(_fd, EPOLL_CTL_DEL, fd, nullptr);
+  auto* found = _find(fd);
+  if (!found) {
+    return;
+  }
+  auto& slot = *found;
+  ++slot.generation;
+  slot.registered = false;
+  slot.watched = false;
+  slot.ready = 0;
+  slot.fn.reset();
+  for (auto& waiter : slot.waiters) {
+    waiter.reset();
+  }
+  _n_fds.fetch_sub(1);
+}
 
-  _tid_calls.erase(_fd_tids[fd]);
-  _fd_tids.erase(fd);
+void EventContext::Handler::watch(int fd) {
+  std::unique_lock guard(_mtx);
+  auto& slot = _slot(fd);
+  ::epoll_event ev;
+  ev.events = ::EPOLLIN | ::EPOLLOUT | ::EPOLLRDHUP | ::EPOLLET;
+  ev.data.u64 = pack_event_data(fd, ++slot.generation);
+  if (::epoll_ctl(_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    --slot.generation;
+    throw std::runtime_error("epoll_ctl add failed");
+  }
+  slot.watched = true;
+  slot.ready = 0;
+  if (!slot.registered) {
+    slot.registered = true;
+    _n_fds.fetch_add(1);
+  }
+  if (_signal) {
+    _signal->emit();
+  }
 }
 
-size_t EventContext::Handler::handle(size_t handle_batch, size_t timeout_ms) {
-  std::vector<::epoll_event> ev_buffer(handle_batch);
-  int active_num = ::epoll_wait(_fd, ev_buffer.data(), ev_buffer.size(), timeout_ms);
+bool EventContext::Handler::wait(int fd, Event dir, Callback&& fn) {
+  std::unique_lock guard(_mtx);
+  auto* found = _find(fd);
+  if (!found || !found->watched) {
+    throw std::runtime_error("wait on an unwatched fd");
+  }
+  auto& slot = *found;
+  if (slot.ready & dir) {
+    slot.ready &= ~size_t(dir);
+    return false;
+  }
+  slot.waiters[_direction(dir)] = std::move(fn);
+  return true;
+}
+
+void EventContext::Handler::unwait(int fd, Event dir) {
+  std::unique_lock guard(_mtx);
+  if (auto* slot = _find(fd)) {
+    slot->waiters[_direction(dir)].reset();
+  }
+}
+
+void EventContext::Handler::_wake(Slot& slot, size_t events) {
+  if (events & Event::ERR) {
+    // errors and hang-ups are seen by the next operation in either direction
+    events |= Event::IN | Event::OUT;
+  }
+  for (size_t dir : {Event::IN, Event::OUT}) {
+    if (!(events & dir)) {
+      continue;
+    }
+    auto& waiter = slot.waiters[_direction(dir)];
+    if (waiter) {
+      _pending.push_back({-1, 0, false, dir, std::move(waiter)});
+    } else {
+      slot.ready |= dir;
+    }
+  }
+}
+
+size_t EventContext::Handler::handle(size_t handle_batch, int timeout_ms) {
+  if (_ev_buffer.size() < handle_batch) {
+    _ev_buffer.resize(handle_batch);
+  }
+  int active_num = ::epoll_wait(_fd, _ev_buffer.data(), handle_batch, timeout_ms);
   if (active_num <= 0) {
     return 0;
   }
-  for (int i = 0; i < active_num; ++i) {
-    int tid = ev_buffer[i].data.u64;
-    Event ev = Event::from_linux(ev_buffer[i].events);
-    std::unique_lock guard(this->_mtx);
-    if (_tid_calls.contains(tid)) {
-      auto& callback = _tid_calls[tid];
-      if (callback.on & ev) {
-        callback.fn(ev);
+
+  // callbacks are taken out of their slots under the lock and run after it is released, so they may take other
+  // locks, or register fds, without stalling the workers which arm fds of this handler
+  bool restore = false;
+  {
+    std::unique_lock guard(_mtx);
+    for (int i = 0; i < active_num; ++i) {
+      uint64_t data = _ev_buffer[i].data.u64;
+      int fd = int(uint32_t(data));
+      uint32_t generation = data >> 32;
+      Event ev = Event::from_linux(_ev_buffer[i].events);
+      auto* found = _find(fd);
+      if (!found || found->generation != generation) {
+        continue;
+      }
+      auto& slot = *found;
+      if (slot.watched) {
+        size_t events = ev;
+        if (_ev_buffer[i].events & ::EPOLLRDHUP) {
+          events |= Event::IN;
+        }
+        _wake(slot, events);
+      } else if ((slot.on & ev) && slot.fn) {
+        // a persistent registration gets its callback back afterwards, unless it is re-armed in the meantime
+        bool persistent = !(slot.on & Event::ONESHOT);
+        restore |= persistent;
+        _pending.push_back({fd, generation, persistent, ev, std::move(slot.fn)});
       }
     }
   }
+
+  for (auto& pending : _pending) {
+    pending.fn(pending.ev);
+  }
+  if (restore) {
+    std::unique_lock guard(_mtx);
+    for (auto& pending : _pending) {
+      if (!pending.persistent) {
+        continue;
+      }
+      auto* slot = _find(pending.fd);
+      if (slot && slot->generation == pending.generation && !slot->fn) {
+        slot->fn = std::move(pending.fn);
+      }
+    }
+  }
+  // captures are destroyed outside of the lock
+  _pending.clear();
   return active_num;
 }
 
 #endif
 
-EventLazySignal::EventLazySignal(Context& ctx, size_t pindex, bool nowait)
-    : _ctx(&ctx), _pindex(pindex), _nowait(nowait) {
+EventLazySignal::EventLazySignal(Context& ctx, size_t pindex) : _ctx(&ctx), _pindex(pindex) {
   _fd = ::eventfd(0, ::EFD_NONBLOCK | ::EFD_CLOEXEC);
-  EventContext::at(ctx).handler(_pindex).add(_fd, Event::IN | Event::ONESHOT, [this](Event ev) { _callback(ev); });
+  _timer_fd = ::timerfd_create(CLOCK_MONOTONIC, ::TFD_NONBLOCK | ::TFD_CLOEXEC);
+  auto& handler = EventContext::at(ctx).handler(_pindex);
+  handler.add(_fd, Event::IN, [this](Event ev) { _callback(ev); });
+  handler.add(_timer_fd, Event::IN, [this](Event) {
+    uint64_t expirations = 0;
+    ::read(_timer_fd, &expirations, sizeof(expirations));
+  });
+  handler.on_handled(this);
 }
 
 void EventLazySignal::close() {
-  EventContext::at(*_ctx).handler(_pindex).del(_fd);
+  auto& handler = EventContext::at(*_ctx).handler(_pindex);
+  handler.on_handled(nullptr);
+  handler.del(_fd);
+  handler.del(_timer_fd);
   ::close(_fd);
+  ::close(_timer_fd);
 }
 
-void EventLazySignal::_emit() { ::write(_fd, &_sig_data, sizeof(_sig_data)); }
+bool EventLazySignal::_pollable() {
+  // the eventfd and timerfd of this signal itself do not count, completions of io_uring are always waited for
+  return UringContext::at(*_ctx) || EventContext::at(*_ctx).handler(_pindex).size() > OwnFds;
+}
 
-void EventLazySignal::_wait(std::unique_lock<Spinlock>& guard, std::chrono::duration<double, std::milli> duration) {
-  if (!_nowait) {
-    _cond.wait_for(guard, duration);
-    EventContext::at(*_ctx).handler(_pindex).mod(_fd, Event::IN | Event::ONESHOT, [this](Event ev) { _callback(ev); });
+void EventLazySignal::_poll(std::chrono::duration<double, std::milli> duration) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  if (ns <= 0) {
+    EventContext::at(*_ctx).run_handler(_pindex, 128, std::chrono::milliseconds(0));
+    return;
   }
+  // epoll counts in milliseconds, the timerfd wakes it at the deadline itself. Arming replaces an earlier deadline
+  ::itimerspec spec = {};
+  spec.it_value.tv_sec = ns / 1000000000;
+  spec.it_value.tv_nsec = ns % 1000000000;
+  ::timerfd_settime(_timer_fd, 0, &spec, nullptr);
+  EventContext::at(*_ctx).run_handler(_pindex, 128, std::chrono::milliseconds(-1));
 }
 
+void EventLazySignal::_interrupt() { ::write(_fd, &_sig_data, sizeof(_sig_data)); }
+
 void EventLazySignal::_callback(Event ev) {
-  std::unique_lock guard(this->_mtx);
-  ::read(_fd, &_sig_data, sizeof(_sig_data));
-  if (!_nowait) {
-    _cond.notify_one();
-  }
+  uint64_t data = 0;
+  ::read(_fd, &data, sizeof(data));
 }
 
 }  // namespace cgo::_impl
@@ -0,0 +1,156 @@
+#include "core/memory.h"
+
+#include <mutex>
+#include <new>
+
+namespace cgo::_impl {
+
+namespace {
+
+struct Registry {
+  std::mutex mtx;
+  std::vector<FramePool*> pools;
+};
+
+// never destroyed: frames may outlive the thread (and the static storage) which allocated them
+auto registry() -> Registry& {
+  static auto r = new Registry();
+  return *r;
+}
+
+thread_local bool thread_exited = false;
+
+}  // namespace
+
+class FramePool::Holder {
+ public:
+  Holder() {
+    auto& r = registry();
+    std::unique_lock guard(r.mtx);
+    for (auto p : r.pools) {
+      if (!p->_adopted) {
+        pool = p;
+        break;
+      }
+    }
+    if (!pool) {
+      pool = r.pools.emplace_back(new FramePool());
+    }
+    pool->_adopted = true;
+    FramePool::_local = pool;
+  }
+
+  ~Holder() {
+    thread_exited = true;
+    FramePool::_local = nullptr;
+    auto& r = registry();
+    std::unique_lock guard(r.mtx);
+    pool->_adopted = false;
+  }
+
+  FramePool* pool = nullptr;
+};
+
+void* FramePool::allocate(size_t n) {
+  size_t size_class = _size_class(n);
+  if (size_class >= ClassNum) {
+    return ::operator new(n);
+  }
+  Header* header = nullptr;
+  auto pool = _this_pool();
+  if (pool) {
+    header = reinterpret_cast<Header*>(pool->_pop(size_class));
+    pool->_live[size_class].fetch_add(1, std::memory_order_relaxed);
+    pool->_bytes[size_class].fetch_add(n, std::memory_order_relaxed);
+  } else {
+    header = static_cast<Header*>(::operator new(_block_size(size_class)));
+  }
+  header->owner = pool;
+  header->size_class = size_class;
+  return header + 1;
+}
+
+void FramePool::deallocate(void* ptr, size_t n) {
+  size_t size_class = _size_class(n);
+  if (size_class >= ClassNum) {
+    ::operator delete(ptr);
+    return;
+  }
+  auto header = static_cast<Header*>(ptr) - 1;
+  auto owner = header->owner;
+  if (!owner) {
+    ::operator delete(header);
+    return;
+  }
+  owner->_live[size_class].fetch_sub(1, std::memory_order_relaxed);
+  owner->_bytes[size_class].fetch_sub(n, std::memory_order_relaxed);
+  auto block = reinterpret_cast<Block*>(header);
+  if (owner == _local) {
+    block->next = owner->_free[size_class];
+    owner->_free[size_class] = block;
+    owner->_cached[size_class].fetch_add(1, std::memory_order_relaxed);
+  } else {
+    owner->_push_remote(size_class, block);
+  }
+}
+
+auto FramePool::stats() -> std::array<Stats, ClassNum> {
+  std::array<Stats, ClassNum> res;
+  for (size_t i = 0; i < ClassNum; ++i) {
+    res[i].block_size = _block_size(i);
+  }
+  auto& r = registry();
+  std::unique_lock guard(r.mtx);
+  for (auto p : r.pools) {
+    for (size_t i = 0; i < ClassNum; ++i) {
+      res[i].live_frames += p->_live[i].load(std::memory_order_relaxed);
+      res[i].live_bytes += p->_bytes[i].load(std::memory_order_relaxed);
+      res[i].cached_frames += p->_cached[i].load(std::memory_order_relaxed);
+    }
+  }
+  return res;
+}
+
+auto FramePool::_this_pool() -> FramePool* {
+  if (_local || thread_exited) {
+    return _local;
+  }
+  thread_local Holder holder;
+  return holder.pool;
+}
+
+auto FramePool::_pop(size_t size_class) -> Block* {
+  if (!_free[size_class]) {
+    _free[size_class] = _remote[size_class].exchange(nullptr, std::memory_order_acquire);
+  }
+  if (!_free[size_class]) {
+    _refill(size_class);
+  }
+  auto block = _free[size_class];
+  _free[size_class] = block->next;
+  _cached[size_class].fetch_sub(1, std::memory_order_relaxed);
+  return block;
+}
+
+void FramePool::_refill(size_t size_class) {
+  size_t block_size = _block_size(size_class);
+  size_t block_num = SlabSize / block_size;
+  auto slab = static_cast<char*>(::operator new(block_num * block_size));
+  _slabs.push_back(slab);
+  for (size_t i = block_num; i > 0; --i) {
+    auto block = reinterpret_cast<Block*>(slab + (i - 1) * block_size);
+    block->next = _free[size_class];
+    _free[size_class] = block;
+  }
+  _cached[size_class].fetch_add(block_num, std::memory_order_relaxed);
+}
+
+void FramePool::_push_remote(size_t size_class, Block* block) {
+  auto& head = _remote[size_class];
+  block->next = head.load(std::memory_order_relaxed);
+  while (!head.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed)) {
+  }
+  _cached[size_class].fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace cgo::_impl
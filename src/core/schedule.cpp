@@ -1,33 +1,66 @@
 #include "core/schedule.h"
 
+#include <algorithm>
+#include <thread>
+#include <utility>
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace cgo::_impl {
 
-void Spinlock::lock() {
-  bool expected = false;
-  while (!_locked.compare_exchange_weak(expected, true)) {
-    expected = false;
+void BaseLazySignal::emit() {
+  if (_state.load(std::memory_order_relaxed) == Emitted) {
+    return;
+  }
+  auto prev = _state.exchange(Emitted);
+  if (prev == Parked) {
+    _unpark();
+  } else if (prev == Polling) {
+    _interrupt();
   }
 }
 
-void BaseLazySignal::emit() {
-  if (_waited && !_emitted) {
-    std::unique_lock guard(_mtx);
-    if (_waited && !_emitted) {
-      _emit();
-      _emitted = true;
-    }
+void BaseLazySignal::wait(std::chrono::duration<double, std::milli> duration) {
+  uint32_t mode = _pollable() ? Polling : Parked;
+  uint32_t expected = Idle;
+  if (!_state.compare_exchange_strong(expected, mode)) {
+    // emitted since the last wait
+    _state.store(Idle);
+    return;
   }
+  if (mode == Parked) {
+    _park(duration);
+  } else {
+    _poll(duration);
+  }
+  _state.store(Idle);
 }
 
-void BaseLazySignal::wait(std::chrono::duration<double, std::milli> duration) {
-  if (!_emitted) {
-    std::unique_lock guard(_mtx);
-    if (!_emitted) {
-      _emitted = false;
-      _waited = true;
-      _wait(guard, duration);
-      _waited = false;
-    }
+void BaseLazySignal::_park(std::chrono::duration<double, std::milli> duration) {
+#if defined(linux) || defined(__linux) || defined(__linux__)
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  ::timespec ts = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_state), FUTEX_WAIT_PRIVATE, Parked, &ts, nullptr, 0);
+#else
+  std::this_thread::sleep_for(std::min(duration, std::chrono::duration<double, std::milli>(1)));
+#endif
+}
+
+void BaseLazySignal::_unpark() {
+#if defined(linux) || defined(__linux) || defined(__linux__)
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+}
+
+SchedContext::SchedContext(Context& ctx, size_t n_partition)
+    : _ctx(&ctx), _task_allocators(n_partition), _task_schedulers(n_partition), _task_mailboxes(n_partition) {
+  for (size_t i = 0; i < n_partition; ++i) {
+    _task_allocators[i]._pindex = i;
+    _task_allocators[i]._n_partition = n_partition;
   }
 }
 
@@ -37,126 +70,439 @@ void SchedContext::final_schedule(size_t pindex) {
   auto& scheduler = _scheduler(pindex);
   scheduler._signal = nullptr;
 
-  auto& allocator = _allocator(pindex);
-  for (auto& task : allocator._pool) {
-    if (task.waiting_cond) {
-      task.waiting_cond->_remove(&task);
-      FrameOperator::destroy(task.fn);
+  for (auto task : _allocator(pindex).live_tasks()) {
+    if (task->waiting_cond) {
+      task->waiting_cond->_remove(task);
+      FrameOperator::destroy(task->fn);
     }
   }
 }
 
 void SchedContext::create_scheduled(Coroutine<void>&& fn) {
-  size_t id = _tid.fetch_add(1);
-  auto task = _allocator(id).create(_ctx, id, std::move(fn));
-  _scheduler(id).push(std::move(task));
+  if (_worker_ctx == this) {
+    auto task = _allocator(_worker_pindex).create(_ctx, std::move(fn));
+    _scheduler(_worker_pindex).push(std::move(task));
+    _notify_parked();
+    return;
+  }
+  auto task = _allocator(_cursor.fetch_add(1, std::memory_order_relaxed)).create(_ctx, std::move(fn));
+  _schedule(std::move(task));
+}
+
+void SchedContext::create_scheduled(size_t pindex, Coroutine<void>&& fn) {
+  auto task = _allocator(pindex).create(_ctx, std::move(fn));
+  if (_worker_ctx == this && _worker_pindex == pindex % _task_schedulers.size()) {
+    _scheduler(pindex).push(std::move(task));
+    return;
+  }
+  _mailbox(pindex).push(std::move(task));
+  _signal(pindex);
+}
+
+void SchedContext::on_scheduled(size_t pindex, BaseLazySignal& signal) {
+  _scheduler(pindex)._signal = &signal;
+  _worker_ctx = this;
+  _worker_pindex = pindex;
 }
 
 size_t SchedContext::run_scheduled(size_t pindex, size_t batch_size) {
+  auto& local = _scheduler(pindex);
   size_t cnt = 0;
   for (; cnt < batch_size; ++cnt) {
-    if (auto task = _scheduler(pindex).pop(); task) {
-      _execute(std::move(task));
-    } else {
+    Allocator::Handler task = nullptr;
+    // check injector periodically, so tasks from outside are not starved by a busy local deque
+    if (cnt % InjectInterval == InjectInterval - 1) {
+      task = _mailbox(pindex).pop();
+      if (!task) {
+        task = _injector.pop();
+      }
+    }
+    // tasks handing off to each other through runnext share one time slice, then queue behind the deque
+    if (!task && local._runnext) {
+      task = Allocator::Handler(std::exchange(local._runnext, nullptr));
+      if (++local._runnext_cnt > RunnextLimit) {
+        local.push(std::move(task));
+        task = nullptr;
+      }
+    }
+    if (!task) {
+      local._runnext_cnt = 0;
+    }
+    if (!task) {
+      task = local.pop();
+    }
+    if (!task) {
+      task = _mailbox(pindex).pop();
+    }
+    if (!task) {
+      task = _injector.pop();
+    }
+    if (!task) {
+      task = _steal(pindex);
+    }
+    if (!task) {
       break;
     }
+    // the last searching worker found tasks, there may be more for another one
+    if (local._searching && _transition_from_searching(pindex)) {
+      _notify_parked();
+    }
+    _execute(std::move(task));
+  }
+  return cnt;
+}
+
+bool SchedContext::park_scheduled(size_t pindex) {
+  auto& local = _scheduler(pindex);
+  if (local._searching) {
+    _transition_from_searching(pindex);
+  }
+  {
+    std::unique_lock guard(_idle_mtx);
+    local._parked = true;
+    _parked.push_back(pindex);
+    _n_parked.fetch_add(1);
   }
-  if (cnt == batch_size) {
-    return cnt;
+  // tasks pushed before the worker is visible as parked are not notified, look for them once more
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (_has_runnable(pindex)) {
+    unpark_scheduled(pindex);
+    return false;
+  }
+  return true;
+}
+
+void SchedContext::unpark_scheduled(size_t pindex) {
+  auto& local = _scheduler(pindex);
+  std::unique_lock guard(_idle_mtx);
+  if (local._parked) {
+    // woken by its signal directly rather than `_notify_parked()`
+    local._parked = false;
+    _parked.erase(std::find(_parked.begin(), _parked.end(), pindex));
+    _n_parked.fetch_sub(1);
   }
+}
+
+void SchedContext::unpark_all() {
   for (size_t i = 0; i < _task_schedulers.size(); ++i) {
-    if (auto task = _scheduler(pindex + i).pop(); task) {
-      _execute(std::move(task));
-      ++cnt;
-      if (cnt == batch_size) {
-        break;
-      }
+    _signal(i);
+  }
+}
+
+void SchedContext::_schedule(Allocator::Handler task) {
+  if (_worker_ctx == this) {
+    _scheduler(_worker_pindex).push(std::move(task));
+  } else {
+    _injector.push(std::move(task));
+  }
+  _notify_parked();
+}
+
+void SchedContext::_wake(Allocator::Handler task) {
+  if (_worker_ctx != this || !_running_task) {
+    _schedule(std::move(task));
+    return;
+  }
+  auto& local = _scheduler(_worker_pindex);
+  auto prev = std::exchange(local._runnext, task.get());
+  if (prev) {
+    local.push(Allocator::Handler(prev));
+    _notify_parked();
+  }
+}
+
+void SchedContext::_signal(size_t pindex) {
+  if (auto signal = _scheduler(pindex)._signal; signal) {
+    signal->emit();
+  }
+}
+
+void SchedContext::_notify_parked() {
+  // pairs with the fence in `park_scheduled()`, either the parked worker finds the task or it is found here
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (_n_searching.load() > 0 || _n_parked.load() == 0) {
+    return;
+  }
+  size_t pindex = 0;
+  {
+    std::unique_lock guard(_idle_mtx);
+    if (_n_searching.load() > 0 || _parked.empty()) {
+      return;
     }
+    pindex = _parked.back();
+    _parked.pop_back();
+    _n_parked.fetch_sub(1);
+    auto& woken = _scheduler(pindex);
+    woken._parked = false;
+    woken._searching = true;
+    _n_searching.fetch_add(1);
   }
-  return cnt;
+  _signal(pindex);
+}
+
+bool SchedContext::_transition_to_searching(size_t pindex) {
+  auto& local = _scheduler(pindex);
+  if (local._searching) {
+    return true;
+  }
+  if (2 * _n_searching.load() >= _task_schedulers.size()) {
+    return false;
+  }
+  local._searching = true;
+  _n_searching.fetch_add(1);
+  return true;
+}
+
+bool SchedContext::_transition_from_searching(size_t pindex) {
+  _scheduler(pindex)._searching = false;
+  return _n_searching.fetch_sub(1) == 1;
+}
+
+bool SchedContext::_has_runnable(size_t pindex) {
+  if (_scheduler(pindex)._runnext || !_mailbox(pindex).empty() || !_injector.empty()) {
+    return true;
+  }
+  for (auto& scheduler : _task_schedulers) {
+    if (scheduler.size() > 0) {
+      return true;
+    }
+  }
+  return false;
 }
 
-auto SchedContext::Allocator::create(Context* ctx, size_t id, Coroutine<void>&& fn) -> Handler {
+auto SchedContext::_steal(size_t pindex) -> Allocator::Handler {
+  if (!_transition_to_searching(pindex)) {
+    return nullptr;
+  }
+  auto& local = _scheduler(pindex);
+  size_t n = _task_schedulers.size();
+  size_t begin = _cursor.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < n; ++i) {
+    size_t victim = (begin + i) % n;
+    if (victim == pindex % n) {
+      continue;
+    }
+    if (_scheduler(victim).steal_half(local) > 0) {
+      return local.pop();
+    }
+  }
+  return nullptr;
+}
+
+SchedContext::Allocator::~Allocator() {
+  // destroying a task may run defers which create tasks, so repeat until nothing is left
+  for (auto tasks = live_tasks(); !tasks.empty(); tasks = live_tasks()) {
+    for (auto task : tasks) {
+      destroy(Handler(task));
+    }
+  }
+}
+
+auto SchedContext::Allocator::create(Context* ctx, Coroutine<void>&& fn) -> Handler {
   Task* task = nullptr;
   {
     std::unique_lock guard(_mtx);
-    _index[id] = _pool.emplace(_pool.end(), ctx, id, std::move(fn));
-    task = &*_index[id];
+    if (!_free) {
+      auto& chunk = _chunks.emplace_back(std::make_unique<Slot[]>(ChunkSize));
+      for (size_t i = ChunkSize; i > 0; --i) {
+        chunk[i - 1].next_free = _free;
+        _free = &chunk[i - 1];
+      }
+    }
+    Slot* slot = _free;
+    _free = slot->next_free;
+    size_t id = (_seq++) * _n_partition + _pindex;
+    // built before it is published, so `live_tasks()` never sees a half-built task. Neither runs user code
+    task = new (slot->storage) Task(ctx, id, std::move(fn));
+    FrameOperator::init(task->fn);
+    slot->live_pos = _live.size();
+    _live.push_back(slot);
   }
-  FrameOperator::init(task->fn);
   return Handler(task);
 }
 
 void SchedContext::Allocator::destroy(SchedContext::Allocator::Handler task) {
-  size_t id = task->id;
+  auto slot = Slot::of(task.get());
   {
+    // unlinked before it is destroyed, so `live_tasks()` never sees a half-destroyed task
     std::unique_lock guard(_mtx);
-    _pool.erase(_index.at(id));
-    _index.erase(id);
+    auto last = _live.back();
+    last->live_pos = slot->live_pos;
+    _live[slot->live_pos] = last;
+    _live.pop_back();
   }
+  // destroying the frame runs defers, which may create tasks
+  slot->task()->~Task();
+  std::unique_lock guard(_mtx);
+  slot->next_free = _free;
+  _free = slot;
 }
 
-void SchedContext::Scheduler::push(SchedContext::Allocator::Handler task) {
+auto SchedContext::Allocator::live_tasks() -> std::vector<Task*> {
+  std::vector<Task*> tasks;
   std::unique_lock guard(_mtx);
-  _runnable_tail.link_front(&*task);
-  if (_signal) {
-    _signal->emit();
+  tasks.reserve(_live.size());
+  for (auto slot : _live) {
+    tasks.push_back(slot->task());
+  }
+  return tasks;
+}
+
+SchedContext::Scheduler::Scheduler() {
+  _buffer = _buffers.emplace_back(std::make_unique<Buffer>(256)).get();
+}
+
+void SchedContext::Scheduler::push(SchedContext::Allocator::Handler task) {
+  auto bottom = _bottom.load(std::memory_order_relaxed);
+  auto top = _top.load(std::memory_order_acquire);
+  auto buffer = _buffer.load(std::memory_order_relaxed);
+  if (bottom - top > static_cast<int64_t>(buffer->mask)) {
+    buffer = _grow(buffer, top, bottom);
   }
+  buffer->slots[bottom & buffer->mask].store(task.get(), std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  _bottom.store(bottom + 1, std::memory_order_relaxed);
 }
 
 auto SchedContext::Scheduler::pop() -> SchedContext::Allocator::Handler {
+  while (true) {
+    auto top = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto bottom = _bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+      return nullptr;
+    }
+    auto buffer = _buffer.load(std::memory_order_acquire);
+    auto task = buffer->slots[top & buffer->mask].load(std::memory_order_relaxed);
+    if (_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return Allocator::Handler(task);
+    }
+  }
+}
+
+size_t SchedContext::Scheduler::steal_half(SchedContext::Scheduler& dst) {
+  size_t n = (size() + 1) / 2;
+  size_t cnt = 0;
+  for (; cnt < n; ++cnt) {
+    auto task = pop();
+    if (!task) {
+      break;
+    }
+    dst.push(std::move(task));
+  }
+  return cnt;
+}
+
+size_t SchedContext::Scheduler::size() const {
+  auto bottom = _bottom.load(std::memory_order_relaxed);
+  auto top = _top.load(std::memory_order_relaxed);
+  return bottom > top ? bottom - top : 0;
+}
+
+auto SchedContext::Scheduler::_grow(Buffer* buffer, int64_t top, int64_t bottom) -> Buffer* {
+  auto grown = _buffers.emplace_back(std::make_unique<Buffer>((buffer->mask + 1) * 2)).get();
+  for (auto i = top; i < bottom; ++i) {
+    grown->slots[i & grown->mask].store(buffer->slots[i & buffer->mask].load(std::memory_order_relaxed),
+                                        std::memory_order_relaxed);
+  }
+  _buffer.store(grown, std::memory_order_release);
+  return grown;
+}
+
+void SchedContext::Injector::push(SchedContext::Allocator::Handler task) {
+  std::unique_lock guard(_mtx);
+  _runnable_tail.link_front(&*task);
+  _size.fetch_add(1, std::memory_order_relaxed);
+}
+
+auto SchedContext::Injector::pop() -> SchedContext::Allocator::Handler {
+  if (empty()) {
+    return nullptr;
+  }
   std::unique_lock guard(_mtx);
   if (_runnable_head.back() == &_runnable_tail) {
     return nullptr;
   }
   auto task = _runnable_head.unlink_back();
+  _size.fetch_sub(1, std::memory_order_relaxed);
   return Allocator::Handler(static_cast<Task*>(task));
 }
 
-Coroutine<void> SchedContext::Condition::wait(std::unique_lock<Spinlock>& guard) {
-  _mtx.lock();  // unlock in caller
-  auto& current = *SchedContext::_running_task;
-  current.waiting_cond = this;
-  auto mtx = current.waiting_mtx = guard.release();
-  co_await std::suspend_always{};  // do schedule in caller by call _suspend_to_this()
-  guard = std::unique_lock(*mtx);  // unlocked in caller
-  _scheduled_ctx = nullptr;
+void SchedContext::Condition::notify() {
+  Task* task = nullptr;
+  {
+    std::unique_lock guard(_mtx);
+    ++_signals;
+    task = _schedule_from_this();
+  }
+  // the woken task may destroy this condition as soon as it runs
+  if (task) {
+    SchedContext::at(*task->ctx)._wake(Allocator::Handler(task));
+  }
+}
+
+bool SchedContext::Condition::_suspend() {
+  _mtx.lock();  // unlock in `_suspend_to_this()` or here if signaled
+  if (_signals > 0) {
+    --_signals;
+    _mtx.unlock();
+    return false;
+  }
+  SchedContext::_running_task->waiting_cond = this;
+  return true;  // do schedule in `SchedContext::_execute()` by call `_suspend_to_this()`
 }
 
-void SchedContext::Condition::notify() {
+bool SchedContext::Condition::_resume(Allocator::Handler& task) {
   std::unique_lock guard(_mtx);
-  _schedule_from_this();
+  if (_signals > 0) {
+    --_signals;
+    return true;
+  }
+  // signal is taken by others before the woken task runs, wait again without resuming its frame
+  task->notified = false;
+  _blocked_tail.link_front(&*task);
+  task = nullptr;
+  return false;
 }
 
-void SchedContext::Condition::_schedule_from_this() {
+auto SchedContext::Condition::_schedule_from_this() -> Task* {
   if (_blocked_head.back() == &_blocked_tail) {
-    return;
+    return nullptr;
   }
   auto task = static_cast<Task*>(_blocked_head.unlink_back());
-  auto ctx = _scheduled_ctx = task->ctx;
-  auto id = task->id;
-  SchedContext::at(*ctx)._scheduler(id).push(Allocator::Handler(task));
+  task->notified = true;
+  return task;
 }
 
-void SchedContext::Condition::_suspend_to_this(Allocator::Handler task, Spinlock* waiting_mtx) {
+void SchedContext::Condition::_suspend_to_this(Allocator::Handler task) {
   _blocked_tail.link_front(&*task);
   _mtx.unlock();
-  waiting_mtx->unlock();
 }
 
 void SchedContext::Condition::_remove(Task* task) {
-  std::unique_lock guard(_mtx);
-  task->unlink_this();
-  if (_scheduled_ctx == nullptr || _scheduled_ctx == task->ctx) {
-    _schedule_from_this();
+  Task* next = nullptr;
+  {
+    std::unique_lock guard(_mtx);
+    if (!task->notified) {
+      task->unlink_this();
+      return;
+    }
+    // the removed task is woken but never consumes the signal, pass the wakeup on
+    next = _schedule_from_this();
+  }
+  if (next) {
+    SchedContext::at(*next->ctx)._wake(Allocator::Handler(next));
   }
 }
 
 void SchedContext::_execute(SchedContext::Allocator::Handler task) {
   auto& current = SchedContext::_running_task = std::move(task);
+  if (auto cond = current->waiting_cond; cond && !cond->_resume(current)) {
+    return;
+  }
   current->yielded = false;
+  current->notified = false;
   current->waiting_cond = nullptr;
-  current->waiting_mtx = nullptr;
 
   ++current->execute_cnt;
   while (!current->yielded && !current->waiting_cond && !FrameOperator::done(current->fn)) {
@@ -166,37 +512,23 @@ void SchedContext::_execute(SchedContext::Allocator::Handler task) {
     _allocator(current->id).destroy(std::move(current));
   } else if (current->yielded) {
     ++current->yield_cnt;
-    _scheduler(current->id).push(std::move(current));
+    // a yielded task is no new work, parked workers are only woken to share a backlog, without the strict ordering
+    auto& local = _scheduler(_worker_pindex);
+    local.push(std::move(current));
+    if (_n_parked.load(std::memory_order_relaxed) > 0 && local.size() > 1) {
+      _notify_parked();
+    }
   } else {
     ++current->suspend_cnt;
-    auto mtx = current->waiting_mtx;
-    current->waiting_cond->_suspend_to_this(std::move(current), mtx);
+    current->waiting_cond->_suspend_to_this(std::move(current));
   }
+  current = nullptr;
 }
 
 }  // namespace cgo::_impl
 
 namespace cgo {
 
-Coroutine<void> Semaphore::aquire() {
-  std::unique_lock guard(_mtx);
-  while (true) {
-    if (_vacant > 0) {
-      _vacant--;
-      break;
-    }
-    co_await _cond.wait(guard);
-  }
-}
-
-void Semaphore::release() {
-  {
-    std::unique_lock guard(_mtx);
-    _vacant++;
-    _cond.notify();
-  }
-}
-
 DeferGuard::DeferGuard(DeferGuard&& rhs) {
   drop();
   std::swap(_defer, rhs._defer);
@@ -1,16 +1,25 @@
 #include "core/event.h"
 #include "core/timed.h"
+#include "core/uring.h"
 
 #if defined(linux) || defined(__linux) || defined(__linux__)
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #endif
 
+#include <algorithm>
+
 namespace cgo {
 
 using _impl::Event;
@@ -22,6 +31,60 @@ union Address {
   ::sockaddr_in6 v6;
 };
 
+/**
+ * @brief Submit one request prepared by `prep`, on the ring of the calling worker if possible, and wait for its result
+ */
+template <typename F>
+static Coroutine<int> uring_call(_impl::UringContext& uring, int fd, std::chrono::duration<double, std::milli> timeout,
+                                 F prep) {
+  _impl::UringOp op;
+  uring.ring_for(fd)->push(&op, op.timeout(timeout), prep);
+  co_await op.wait();
+  co_return op.result();
+}
+
+static auto uring_error(int fd, int res, const char* timeout_msg) -> Socket::Error {
+  if (res == -ETIME) {
+    return Socket::Error(fd, ETIMEDOUT, timeout_msg);
+  }
+  if (res == -ECANCELED) {
+    return Socket::Error(fd, ECANCELED, "socket closed");
+  }
+  if (res == -ECONNRESET || res == -EPIPE) {
+    return Socket::Error(fd, -res, "close by other side");
+  }
+  return Socket::Error(fd, -res, ::strerror(-res));
+}
+
+/**
+ * @brief Read completion notifications of `MSG_ZEROCOPY` sends queued on the error queue of `fd`
+ *
+ * @return Number of sends completed
+ */
+static size_t reap_zerocopy(int fd) {
+  size_t completed = 0;
+  while (true) {
+    char control[CMSG_SPACE(sizeof(::sock_extended_err)) + CMSG_SPACE(sizeof(::sockaddr_in6))];
+    ::msghdr msg = {};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+      return completed;
+    }
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      auto err = reinterpret_cast<const ::sock_extended_err*>(CMSG_DATA(cmsg));
+      if (err->ee_errno == 0 && err->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+        // ids of the completed sends, in a range
+        completed += err->ee_data - err->ee_info + 1;
+      }
+    }
+  }
+}
+
 Socket::Socket(Context& ctx, Socket::Protocol protocol, Socket::AddressFamily family)
     : _ctx(&ctx), _protocol(protocol), _family(family) {
   int type = (protocol == Protocol::TCP) ? SOCK_STREAM : SOCK_DGRAM;
@@ -81,23 +144,46 @@ std::expected<void, Socket::Error> Socket::listen(size_t backlog) {
   return {};
 }
 
+std::expected<void, Socket::Error> Socket::set_gro(bool enable) {
+  if (_protocol != Protocol::UDP) {
+    return std::unexpected(Error(_fd, 0, "GRO only supported for UDP sockets"));
+  }
+  int optval = enable ? 1 : 0;
+  if (::setsockopt(_fd, SOL_UDP, UDP_GRO, &optval, sizeof(optval)) < 0) {
+    return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+  }
+  return {};
+}
+
 Coroutine<std::expected<Socket, Socket::Error>> Socket::accept() { return accept(*_ctx); }
 
 Coroutine<std::expected<Socket, Socket::Error>> Socket::accept(Context& ctx) {
   if (_protocol != Protocol::TCP) {
     co_return std::unexpected(Error(_fd, 0, "Accept only supported for TCP sockets"));
   }
+  if (auto uring = _impl::UringContext::at(*_ctx)) {
+    int fd = co_await _uring->accept(*uring);
+    if (fd < 0) {
+      co_return std::unexpected(Error(_fd, -fd, ::strerror(-fd)));
+    }
+    Socket sock(ctx, fd, _protocol, _family);
+    sock._timeout_slack = _timeout_slack;
+    co_return sock;
+  }
+
   ::sockaddr_in caddr = {};
   socklen_t sin_size = sizeof(caddr);
   while (true) {
     int fd = ::accept(_fd, (sockaddr*)&caddr, &sin_size);
     if (fd > 0) {
-      co_return Socket(ctx, fd, _protocol, _family);
+      Socket sock(ctx, fd, _protocol, _family);
+      sock._timeout_slack = _timeout_slack;
+      co_return sock;
     }
     if (errno != EAGAIN && errno != EWOULDBLOCK) {
       co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
     }
-    co_await _wait_sock_event(Event::IN | Event::ONESHOT);
+    co_await _wait_sock_event(Event::IN);
   }
 }
 
@@ -124,6 +210,19 @@ Coroutine<std::expected<void, Socket::Error>> Socket::connect(const std::string&
     uaddr.v6 = saddr;
   }
 
+  if (auto uring = _impl::UringContext::at(*_ctx); uring && _protocol == Protocol::TCP) {
+    int res = co_await uring_call(*uring, _fd, timeout, [&](::io_uring_sqe& sqe) {
+      sqe.opcode = IORING_OP_CONNECT;
+      sqe.fd = _fd;
+      sqe.addr = reinterpret_cast<uint64_t>(&uaddr);
+      sqe.off = _family == AddressFamily::IPv4 ? sizeof(uaddr.v4) : sizeof(uaddr.v6);
+    });
+    if (res < 0) {
+      co_return std::unexpected(uring_error(_fd, res, "connect timeout"));
+    }
+    co_return {};
+  }
+
   if (::connect(_fd, (sockaddr*)&uaddr, _family == AddressFamily::IPv4 ? sizeof(uaddr.v4) : sizeof(uaddr.v6)) == 0) {
     co_return {};
   }
@@ -137,30 +236,85 @@ Coroutine<std::expected<void, Socket::Error>> Socket::connect(const std::string&
     co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
   }
 
-  if (!(co_await _wait_sock_event(Event::OUT | Event::ONESHOT, timeout))) {
-    co_return std::unexpected(Error(_fd, errno, "connect timeout"));
-  }
+  while (true) {
+    if (!(co_await _wait_sock_event(Event::OUT, timeout))) {
+      co_return std::unexpected(Error(_fd, errno, "connect timeout"));
+    }
 
-  int conn_status = 0;
-  socklen_t len = sizeof(conn_status);
-  if (::getsockopt(_fd, SOL_SOCKET, SO_ERROR, &conn_status, &len) < 0) {
-    co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
-  }
-  if (conn_status != 0) {
-    co_return std::unexpected(Error(_fd, conn_status, ::strerror(conn_status)));
+    int conn_status = 0;
+    socklen_t len = sizeof(conn_status);
+    if (::getsockopt(_fd, SOL_SOCKET, SO_ERROR, &conn_status, &len) < 0) {
+      co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+    }
+    if (conn_status != 0) {
+      co_return std::unexpected(Error(_fd, conn_status, ::strerror(conn_status)));
+    }
+    // readiness cached before the connect started does not mean it is done
+    Address peer;
+    socklen_t peer_len = sizeof(peer);
+    if (::getpeername(_fd, (sockaddr*)&peer, &peer_len) == 0) {
+      co_return {};
+    }
+    if (errno != ENOTCONN) {
+      co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+    }
   }
 }
 
 Coroutine<std::expected<std::string, Socket::Error>> Socket::recv(size_t size,
                                                                   std::chrono::duration<double, std::milli> timeout) {
   std::string res(size, '\0');
+  ::iovec iov = {res.data(), res.size()};
+  auto n = co_await readv(std::span(&iov, 1), timeout);
+  if (!n) {
+    co_return std::unexpected(std::move(n.error()));
+  }
+  res.resize(*n);
+  co_return res;
+}
+
+Coroutine<std::expected<size_t, Socket::Error>> Socket::recv_into(std::span<std::byte> buffer,
+                                                                  std::chrono::duration<double, std::milli> timeout) {
+  ::iovec iov = {buffer.data(), buffer.size()};
+  co_return co_await readv(std::span(&iov, 1), timeout);
+}
+
+Coroutine<std::expected<size_t, Socket::Error>> Socket::readv(std::span<const ::iovec> parts,
+                                                              std::chrono::duration<double, std::milli> timeout) {
+  // nothing to read into, a TCP recv would return 0 as if the peer closed
+  if (std::all_of(parts.begin(), parts.end(), [](const ::iovec& part) { return part.iov_len == 0; })) {
+    co_return 0;
+  }
+  ::msghdr msg = {};
+  msg.msg_iov = const_cast<::iovec*>(parts.data());
+  msg.msg_iovlen = std::min<size_t>(parts.size(), IOV_MAX);
+  if (auto uring = _impl::UringContext::at(*_ctx)) {
+    while (true) {
+      int n = _uring ? co_await _uring->recv(*_ctx, *uring, parts, timeout, _timeout_slack)
+                     : co_await uring_call(*uring, _fd, timeout, [&](::io_uring_sqe& sqe) {
+                         sqe.opcode = IORING_OP_RECVMSG;
+                         sqe.fd = _fd;
+                         sqe.addr = reinterpret_cast<uint64_t>(&msg);
+                         sqe.len = 1;
+                       });
+      if (n > 0) {
+        co_return n;
+      }
+      if (n == 0 && _protocol == Protocol::TCP) {
+        co_return std::unexpected(Error(_fd, 0, "close by other side"));
+      }
+      if (n < 0) {
+        co_return std::unexpected(uring_error(_fd, n, "recv timeout"));
+      }
+    }
+  }
+
   while (true) {
-    int n = (_protocol == Protocol::TCP) ? ::recv(_fd, res.data(), res.size(), 0)
-                                         : ::recv(_fd, res.data(), res.size(), MSG_DONTWAIT);
+    int flags = (_protocol == Protocol::TCP) ? 0 : MSG_DONTWAIT;
+    int n = (parts.size() == 1) ? ::recv(_fd, parts[0].iov_base, parts[0].iov_len, flags) : ::recvmsg(_fd, &msg, flags);
 
     if (n > 0) {
-      res.resize(n);
-      co_return res;
+      co_return n;
     }
     if (n == 0 && _protocol == Protocol::TCP) {
       co_return std::unexpected(Error(_fd, 0, "close by other side"));
@@ -173,14 +327,32 @@ Coroutine<std::expected<std::string, Socket::Error>> Socket::recv(size_t size,
         co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
       }
     }
-    if (!(co_await _wait_sock_event(Event::IN | Event::ONESHOT, timeout))) {
+    if (!(co_await _wait_sock_event(Event::IN, timeout))) {
       co_return std::unexpected(Error(_fd, ETIMEDOUT, "recv timeout"));
     }
   }
 }
 
-Coroutine<std::expected<void, Socket::Error>> Socket::send(const std::string& data,
+Coroutine<std::expected<void, Socket::Error>> Socket::send(std::span<const std::byte> buffer,
                                                            std::chrono::duration<double, std::milli> timeout) {
+  auto data = std::string_view(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  if (auto uring = _impl::UringContext::at(*_ctx)) {
+    for (size_t i = 0; i < data.size();) {
+      int n = co_await uring_call(*uring, _fd, timeout, [&](::io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_SEND;
+        sqe.fd = _fd;
+        sqe.addr = reinterpret_cast<uint64_t>(data.data() + i);
+        sqe.len = data.size() - i;
+        sqe.msg_flags = MSG_NOSIGNAL;
+      });
+      if (n < 0) {
+        co_return std::unexpected(uring_error(_fd, n, "send timeout"));
+      }
+      i += n;
+    }
+    co_return {};
+  }
+
   for (size_t i = 0; i < data.size();) {
     int n = (_protocol == Protocol::TCP) ? ::send(_fd, data.data() + i, data.size() - i, MSG_NOSIGNAL)
                                          : ::send(_fd, data.data() + i, data.size() - i, MSG_DONTWAIT | MSG_NOSIGNAL);
@@ -197,7 +369,227 @@ Coroutine<std::expected<void, Socket::Error>> Socket::send(const std::string& da
         co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
       }
     }
-    if (!(co_await _wait_sock_event(Event::OUT | Event::ONESHOT, timeout))) {
+    if (!(co_await _wait_sock_event(Event::OUT, timeout))) {
+      co_return std::unexpected(Error(_fd, ETIMEDOUT, "send timeout"));
+    }
+  }
+  co_return {};
+}
+
+Coroutine<std::expected<void, Socket::Error>> Socket::send_zerocopy(std::span<const std::byte> buffer,
+                                                                    std::chrono::duration<double, std::milli> timeout) {
+  int zerocopy = 0;
+  socklen_t len = sizeof(zerocopy);
+  if (::getsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &zerocopy, &len) < 0 || !zerocopy) {
+    // `MSG_ZEROCOPY` would copy silently, and no notification would come
+    co_return co_await send(buffer, timeout);
+  }
+
+  auto data = reinterpret_cast<const char*>(buffer.data());
+  if (auto uring = _impl::UringContext::at(*_ctx)) {
+    for (size_t i = 0; i < buffer.size();) {
+      // completes on the notification
+      int n = co_await uring_call(*uring, _fd, timeout, [&](::io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_SEND_ZC;
+        sqe.fd = _fd;
+        sqe.addr = reinterpret_cast<uint64_t>(data + i);
+        sqe.len = buffer.size() - i;
+        sqe.msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+      });
+      if (n < 0) {
+        co_return std::unexpected(uring_error(_fd, n, "send timeout"));
+      }
+      i += n;
+    }
+    co_return {};
+  }
+
+  // every successful send takes the next notification id of the socket, so while no other zero-copy send is in
+  // progress, the notifications read here are those of the sends issued here
+  size_t issued = 0;
+  size_t completed = 0;
+  size_t i = 0;
+  while (true) {
+    if (i < buffer.size()) {
+      int n = ::send(_fd, data + i, buffer.size() - i, MSG_DONTWAIT | MSG_NOSIGNAL | MSG_ZEROCOPY);
+      if (n > 0) {
+        i += n;
+        ++issued;
+        continue;
+      }
+      if (n < 0) {
+        if (errno == ECONNRESET || errno == EPIPE) {
+          co_return std::unexpected(Error(_fd, errno, "close by other side"));
+        }
+        // `ENOBUFS` when the pages pinned by the socket reach the limit, until some are released
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+          co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+        }
+      }
+    }
+    completed += reap_zerocopy(_fd);
+    if (i == buffer.size() && completed >= issued) {
+      co_return {};
+    }
+    // notifications raise `Event::ERR`, which wakes the writer as well
+    if (!(co_await _wait_sock_event(Event::OUT, timeout))) {
+      co_return std::unexpected(Error(_fd, ETIMEDOUT, "send timeout"));
+    }
+  }
+}
+
+Coroutine<std::expected<void, Socket::Error>> Socket::send_file(int file_fd, off_t offset, size_t length,
+                                                                std::chrono::duration<double, std::milli> timeout) {
+  while (length > 0) {
+    auto n = ::sendfile(_fd, file_fd, &offset, length);
+    if (n > 0) {
+      length -= n;
+      continue;
+    }
+    if (n == 0) {
+      co_return std::unexpected(Error(_fd, EINVAL, "file ended before length"));
+    }
+    if (errno == ECONNRESET || errno == EPIPE) {
+      co_return std::unexpected(Error(_fd, errno, "close by other side"));
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+    }
+    if (!(co_await _wait_sock_event(Event::OUT, timeout))) {
+      co_return std::unexpected(Error(_fd, ETIMEDOUT, "send timeout"));
+    }
+  }
+  co_return {};
+}
+
+Coroutine<std::expected<size_t, Socket::Error>> Socket::relay(Socket& to,
+                                                              std::chrono::duration<double, std::milli> timeout) {
+  static constexpr size_t PipeSize = 1024 * 1024;
+
+  size_t total = 0;
+  if (_uring && _uring->buffering()) {
+    // data may wait in provided buffers already, and the multishot recv takes what arrives, so it is copied
+    std::vector<std::byte> buffer(64 * 1024);
+    while (true) {
+      auto n = co_await recv_into(buffer, timeout);
+      if (!n) {
+        if (n.error().err_code == 0) {
+          co_return total;
+        }
+        co_return std::unexpected(std::move(n.error()));
+      }
+      auto sent = co_await to.send(std::span<const std::byte>(buffer.data(), *n), timeout);
+      if (!sent) {
+        co_return std::unexpected(std::move(sent.error()));
+      }
+      total += *n;
+    }
+  }
+
+  int pipe_fds[2];
+  if (::pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+  }
+  auto guard = defer([&pipe_fds]() {
+    ::close(pipe_fds[0]);
+    ::close(pipe_fds[1]);
+  });
+  // a larger pipe moves more per splice, the default one is kept if not permitted
+  ::fcntl(pipe_fds[1], F_SETPIPE_SZ, PipeSize);
+
+  size_t buffered = 0;  // in the pipe
+  bool eof = false;
+  while (!eof || buffered > 0) {
+    if (!eof) {
+      auto n = ::splice(_fd, nullptr, pipe_fds[1], nullptr, PipeSize, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        buffered += n;
+      } else if (n == 0) {
+        eof = true;
+      } else if (errno == ECONNRESET) {
+        co_return std::unexpected(Error(_fd, errno, "close by other side"));
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+      }
+    }
+
+    if (buffered > 0) {
+      auto n = ::splice(pipe_fds[0], nullptr, to._fd, nullptr, buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        buffered -= n;
+        total += n;
+        continue;
+      }
+      if (errno == ECONNRESET || errno == EPIPE) {
+        co_return std::unexpected(Error(to._fd, errno, "close by other side"));
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        co_return std::unexpected(Error(to._fd, errno, ::strerror(errno)));
+      }
+      if (!(co_await to._wait_sock_event(Event::OUT, timeout))) {
+        co_return std::unexpected(Error(to._fd, ETIMEDOUT, "send timeout"));
+      }
+      continue;
+    }
+
+    // the pipe is empty, so the socket had nothing to read
+    if (!eof && !(co_await _wait_sock_event(Event::IN, timeout))) {
+      co_return std::unexpected(Error(_fd, ETIMEDOUT, "recv timeout"));
+    }
+  }
+  co_return total;
+}
+
+Coroutine<std::expected<void, Socket::Error>> Socket::writev(std::span<const ::iovec> parts,
+                                                             std::chrono::duration<double, std::milli> timeout) {
+  // a copy of the descriptors only, advanced past what is written
+  std::vector<::iovec> iov(parts.begin(), parts.end());
+  size_t i = 0;
+  auto advance = [&iov, &i](size_t n) {
+    for (; i < iov.size() && n >= iov[i].iov_len; ++i) {
+      n -= iov[i].iov_len;
+    }
+    if (i < iov.size()) {
+      iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + n;
+      iov[i].iov_len -= n;
+    }
+  };
+  advance(0);
+
+  auto uring = _impl::UringContext::at(*_ctx);
+  while (i < iov.size()) {
+    ::msghdr msg = {};
+    msg.msg_iov = iov.data() + i;
+    msg.msg_iovlen = std::min<size_t>(iov.size() - i, IOV_MAX);
+    if (uring) {
+      int n = co_await uring_call(*uring, _fd, timeout, [&](::io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_SENDMSG;
+        sqe.fd = _fd;
+        sqe.addr = reinterpret_cast<uint64_t>(&msg);
+        sqe.len = 1;
+        sqe.msg_flags = MSG_NOSIGNAL;
+      });
+      if (n < 0) {
+        co_return std::unexpected(uring_error(_fd, n, "send timeout"));
+      }
+      advance(n);
+      continue;
+    }
+
+    int n = ::sendmsg(_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n > 0) {
+      advance(n);
+      continue;
+    }
+    if (n < 0) {
+      if (errno == ECONNRESET || errno == EPIPE) {
+        co_return std::unexpected(Error(_fd, errno, "close by other side"));
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+      }
+    }
+    if (!(co_await _wait_sock_event(Event::OUT, timeout))) {
       co_return std::unexpected(Error(_fd, ETIMEDOUT, "send timeout"));
     }
   }
@@ -232,6 +624,25 @@ Coroutine<std::expected<size_t, Socket::Error>> Socket::sendto(const std::string
   }
 
   ::socklen_t addr_size = _family == AddressFamily::IPv4 ? sizeof(uaddr.v4) : sizeof(uaddr.v6);
+  if (auto uring = _impl::UringContext::at(*_ctx)) {
+    ::iovec iov = {const_cast<char*>(data.data()), data.size()};
+    ::msghdr msg = {};
+    msg.msg_name = &uaddr;
+    msg.msg_namelen = addr_size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    int n = co_await uring_call(*uring, _fd, timeout, [&](::io_uring_sqe& sqe) {
+      sqe.opcode = IORING_OP_SENDMSG;
+      sqe.fd = _fd;
+      sqe.addr = reinterpret_cast<uint64_t>(&msg);
+      sqe.len = 1;
+      sqe.msg_flags = MSG_NOSIGNAL;
+    });
+    if (n < 0) {
+      co_return std::unexpected(uring_error(_fd, n, "send_to timeout"));
+    }
+    co_return static_cast<size_t>(n);
+  }
   while (true) {
     int n = ::sendto(_fd, data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL, (sockaddr*)&uaddr, addr_size);
     if (n >= 0) {
@@ -240,7 +651,7 @@ Coroutine<std::expected<size_t, Socket::Error>> Socket::sendto(const std::string
     if (errno != EAGAIN && errno != EWOULDBLOCK) {
       co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
     }
-    if (!(co_await _wait_sock_event(Event::OUT | Event::ONESHOT, timeout))) {
+    if (!(co_await _wait_sock_event(Event::OUT, timeout))) {
       co_return std::unexpected(Error(_fd, ETIMEDOUT, "send_to timeout"));
     }
   }
@@ -265,8 +676,28 @@ Coroutine<std::expected<std::pair<std::string, std::pair<std::string, uint16_t>>
 
   std::string buffer(size, '\0');
   ::socklen_t addr_size = _family == AddressFamily::IPv4 ? sizeof(uaddr.v4) : sizeof(uaddr.v6);
+  auto uring = _impl::UringContext::at(*_ctx);
   while (true) {
-    int n = ::recvfrom(_fd, buffer.data(), buffer.size(), MSG_DONTWAIT, (sockaddr*)&uaddr, &addr_size);
+    int n = 0;
+    if (uring) {
+      ::iovec iov = {buffer.data(), buffer.size()};
+      ::msghdr msg = {};
+      msg.msg_name = &uaddr;
+      msg.msg_namelen = addr_size;
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      n = co_await uring_call(*uring, _fd, timeout, [&](::io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_RECVMSG;
+        sqe.fd = _fd;
+        sqe.addr = reinterpret_cast<uint64_t>(&msg);
+        sqe.len = 1;
+      });
+      if (n < 0) {
+        co_return std::unexpected(uring_error(_fd, n, "recv_from timeout"));
+      }
+    } else {
+      n = ::recvfrom(_fd, buffer.data(), buffer.size(), MSG_DONTWAIT, (sockaddr*)&uaddr, &addr_size);
+    }
     if (n > 0) {
       if (_family == AddressFamily::IPv4) {
         char ip_str[INET_ADDRSTRLEN];
@@ -289,14 +720,161 @@ Coroutine<std::expected<std::pair<std::string, std::pair<std::string, uint16_t>>
         co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
       }
     }
-    if (!(co_await _wait_sock_event(Event::IN | Event::ONESHOT, timeout))) {
+    if (!uring && !(co_await _wait_sock_event(Event::IN, timeout))) {
       co_return std::unexpected(Error(_fd, ETIMEDOUT, "recv_from timeout"));
     }
   }
 }
 
+Coroutine<std::expected<size_t, Socket::Error>> Socket::recv_batch(DatagramBatch& batch,
+                                                                   std::chrono::duration<double, std::milli> timeout) {
+  if (_protocol != Protocol::UDP) {
+    co_return std::unexpected(Error(_fd, 0, "recv_batch only supported for UDP sockets"));
+  }
+  batch.clear();
+  if (batch.capacity() == 0) {
+    co_return 0;
+  }
+
+  batch._prepare(batch.capacity(), true);
+  while (true) {
+    int n = ::recvmmsg(_fd, batch._headers.data(), batch.capacity(), MSG_DONTWAIT, nullptr);
+    if (n > 0) {
+      for (int i = 0; i < n; ++i) {
+        auto& hdr = batch._headers[i].msg_hdr;
+        batch._iovs[i].iov_len = batch._headers[i].msg_len;
+        batch._peers[i].size = hdr.msg_namelen;
+        batch._segments[i] = 0;
+        for (auto cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+          if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int segment_size = 0;
+            ::memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+            batch._segments[i] = segment_size;
+          }
+        }
+      }
+      batch._size = n;
+      co_return n;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+    }
+    if (!(co_await _wait_sock_event(Event::IN, timeout))) {
+      co_return std::unexpected(Error(_fd, ETIMEDOUT, "recv_batch timeout"));
+    }
+  }
+}
+
+Coroutine<std::expected<void, Socket::Error>> Socket::send_batch(DatagramBatch& batch,
+                                                                 std::chrono::duration<double, std::milli> timeout) {
+  if (_protocol != Protocol::UDP) {
+    co_return std::unexpected(Error(_fd, 0, "send_batch only supported for UDP sockets"));
+  }
+
+  batch._prepare(batch.size(), false);
+  for (size_t i = 0; i < batch.size();) {
+    int n = ::sendmmsg(_fd, batch._headers.data() + i, batch.size() - i, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n > 0) {
+      i += n;
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      co_return std::unexpected(Error(_fd, errno, ::strerror(errno)));
+    }
+    if (!(co_await _wait_sock_event(Event::OUT, timeout))) {
+      co_return std::unexpected(Error(_fd, ETIMEDOUT, "send_batch timeout"));
+    }
+  }
+  co_return {};
+}
+
+auto Endpoint::from(const std::string& ip, uint16_t port) -> std::optional<Endpoint> {
+  Endpoint endpoint;
+  if (::inet_pton(AF_INET, ip.c_str(), &endpoint.addr.v4.sin_addr) > 0) {
+    endpoint.addr.v4.sin_family = AF_INET;
+    endpoint.addr.v4.sin_port = htons(port);
+    endpoint.size = sizeof(endpoint.addr.v4);
+    return endpoint;
+  }
+  if (::inet_pton(AF_INET6, ip.c_str(), &endpoint.addr.v6.sin6_addr) > 0) {
+    endpoint.addr.v6.sin6_family = AF_INET6;
+    endpoint.addr.v6.sin6_port = htons(port);
+    endpoint.size = sizeof(endpoint.addr.v6);
+    return endpoint;
+  }
+  return std::nullopt;
+}
+
+std::string Endpoint::ip() const {
+  char ip_str[INET6_ADDRSTRLEN] = {};
+  if (addr.v4.sin_family == AF_INET) {
+    ::inet_ntop(AF_INET, &addr.v4.sin_addr, ip_str, sizeof(ip_str));
+  } else {
+    ::inet_ntop(AF_INET6, &addr.v6.sin6_addr, ip_str, sizeof(ip_str));
+  }
+  return ip_str;
+}
+
+uint16_t Endpoint::port() const {
+  return ntohs(addr.v4.sin_family == AF_INET ? addr.v4.sin_port : addr.v6.sin6_port);
+}
+
+DatagramBatch::DatagramBatch(size_t capacity, size_t datagram_size)
+    : _datagram_size(datagram_size),
+      _arena(capacity * datagram_size),
+      _peers(capacity),
+      _iovs(capacity),
+      _headers(capacity),
+      _segments(capacity),
+      _controls(capacity) {
+  for (size_t i = 0; i < capacity; ++i) {
+    _iovs[i].iov_base = _arena.data() + i * datagram_size;
+  }
+}
+
+bool DatagramBatch::push(std::span<const std::byte> data, const Endpoint& peer, uint16_t segment_size) {
+  if (_size == capacity() || data.size() > _datagram_size) {
+    return false;
+  }
+  ::memcpy(_iovs[_size].iov_base, data.data(), data.size());
+  _iovs[_size].iov_len = data.size();
+  _peers[_size] = peer;
+  _segments[_size] = segment_size;
+  ++_size;
+  return true;
+}
+
+void DatagramBatch::_prepare(size_t n, bool recv) {
+  for (size_t i = 0; i < n; ++i) {
+    auto& hdr = _headers[i].msg_hdr;
+    hdr = {};
+    hdr.msg_name = &_peers[i].addr;
+    hdr.msg_namelen = recv ? sizeof(_peers[i].addr) : _peers[i].size;
+    hdr.msg_iov = &_iovs[i];
+    hdr.msg_iovlen = 1;
+    if (recv) {
+      _iovs[i].iov_len = _datagram_size;
+      hdr.msg_control = &_controls[i];
+      hdr.msg_controllen = sizeof(Control);
+    } else if (_segments[i] > 0 && _iovs[i].iov_len > _segments[i]) {
+      hdr.msg_control = &_controls[i];
+      hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+      auto cmsg = CMSG_FIRSTHDR(&hdr);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      ::memcpy(CMSG_DATA(cmsg), &_segments[i], sizeof(uint16_t));
+    }
+  }
+}
+
 void Socket::close() {
-  _impl::EventContext::at(*_ctx).del(_fd);
+  if (auto uring = _impl::UringContext::at(*_ctx)) {
+    // requests in flight hold the file open
+    uring->cancel(_fd);
+  } else {
+    _impl::EventContext::at(*_ctx).del(_fd);
+  }
   ::close(_fd);
 }
 
@@ -321,7 +899,14 @@ void Socket::_set_sock_opt() {
   int enable = 1;
   ::setsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable));
 
-  _impl::EventContext::at(*_ctx).add(_fd, Event::ERR | Event::ONESHOT, [](Event) {});
+  if (_impl::UringContext::at(*_ctx)) {
+    // operations are submitted as requests, no readiness is watched
+    if (_protocol == Protocol::TCP) {
+      _uring = std::make_shared<_impl::UringSocket>(_fd);
+    }
+    return;
+  }
+  _impl::EventContext::at(*_ctx).watch(_fd);
 }
 
 #endif
@@ -332,24 +917,47 @@ Coroutine<bool> Socket::_wait_sock_event(Event on, std::chrono::duration<double,
     Semaphore signal = {0};
   };
 
+#if defined(linux) || defined(__linux) || defined(__linux__)
+  if (auto uring = _impl::UringContext::at(*_ctx)) {
+    int res = co_await uring_call(*uring, _fd, timeout, [&](::io_uring_sqe& sqe) {
+      sqe.opcode = IORING_OP_POLL_ADD;
+      sqe.fd = _fd;
+      sqe.poll32_events = (on & Event::IN) ? (EPOLLIN | EPOLLRDHUP) : EPOLLOUT;
+    });
+    co_return res != -ETIME && res != -ECANCELED;
+  }
+#endif
+
   auto s = std::make_shared<Signal>(0);
-  _impl::EventContext::at(*_ctx).mod(_fd, on, [s](Event) {
+  auto& events = _impl::EventContext::at(*_ctx);
+  bool waiting = events.wait(_fd, on, [s](Event) {
     int expected = 0;
     if (s->timeout.compare_exchange_weak(expected, 1)) {
       s->signal.release();
     }
   });
+  if (!waiting) {
+    // became ready since the operation failed, retry it
+    co_return true;
+  }
+  _impl::TimedContext::Handle timer;
   if (timeout.count() > 0) {
-    _impl::TimedContext::at(*_ctx).create_timeout(
+    timer = _impl::TimedContext::at(*_ctx).create_timeout(
         [s]() {
           int expected = 0;
           if (s->timeout.compare_exchange_weak(expected, -1)) {
             s->signal.release();
           }
         },
-        timeout);
+        timeout, _timeout_slack);
   }
   co_await s->signal.aquire();
+  if (s->timeout == 1) {
+    // satisfied by I/O, the timer would only hold `s` until it expires
+    timer.cancel();
+  } else {
+    events.unwait(_fd, on);
+  }
   co_return (s->timeout == 1);
 }
 
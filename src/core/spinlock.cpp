@@ -0,0 +1,181 @@
+#include "core/spinlock.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cgo::_impl {
+
+namespace {
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// spinning never helps when the lock holder can not run at the same time
+const bool multi_core = std::thread::hardware_concurrency() > 1;
+
+#if defined(CGO_LOCK_STATS)
+struct Registry {
+  std::mutex mtx;
+  std::unordered_set<const Spinlock*> live;
+  std::unordered_map<std::string_view, Spinlock::Stats> retired;
+};
+
+// never destroyed: locks with static storage may be destroyed after it
+auto registry() -> Registry& {
+  static auto r = new Registry();
+  return *r;
+}
+#endif
+
+}  // namespace
+
+Spinlock::Spinlock([[maybe_unused]] const char* name) {
+#if defined(CGO_LOCK_STATS)
+  _name = name;
+  auto& r = registry();
+  std::unique_lock guard(r.mtx);
+  r.live.insert(this);
+#endif
+}
+
+Spinlock::~Spinlock() {
+#if defined(CGO_LOCK_STATS)
+  auto& r = registry();
+  std::unique_lock guard(r.mtx);
+  r.live.erase(this);
+  auto& total = r.retired[_name];
+  total.name = _name;
+  total.acquisitions += _acquisitions.load(std::memory_order_relaxed);
+  total.spins += _spins.load(std::memory_order_relaxed);
+  total.parks += _parks.load(std::memory_order_relaxed);
+#endif
+}
+
+auto Spinlock::stats() -> std::vector<Stats> {
+  std::vector<Stats> res;
+#if defined(CGO_LOCK_STATS)
+  auto& r = registry();
+  std::unique_lock guard(r.mtx);
+  for (auto lock : r.live) {
+    res.push_back({lock->_name, lock, lock->_acquisitions.load(std::memory_order_relaxed),
+                   lock->_spins.load(std::memory_order_relaxed), lock->_parks.load(std::memory_order_relaxed)});
+  }
+  for (auto& [_, total] : r.retired) {
+    res.push_back(total);
+  }
+#endif
+  return res;
+}
+
+void Spinlock::dump_stats(std::FILE* out) {
+  if (!StatsEnabled) {
+    return;
+  }
+  auto all = stats();
+  std::unordered_map<std::string_view, Stats> merged;
+  std::vector<Stats> live;
+  for (auto& s : all) {
+    auto& m = merged[s.name];
+    m.name = s.name;
+    m.acquisitions += s.acquisitions;
+    m.spins += s.spins;
+    m.parks += s.parks;
+    if (s.lock && (s.spins || s.parks)) {
+      live.push_back(s);
+    }
+  }
+  auto by_contention = [](const Stats& a, const Stats& b) {
+    return a.parks != b.parks ? a.parks > b.parks : a.spins > b.spins;
+  };
+
+  std::vector<Stats> names;
+  for (auto& [_, m] : merged) {
+    names.push_back(m);
+  }
+  std::sort(names.begin(), names.end(), by_contention);
+  std::fprintf(out, "%-16s %14s %14s %10s\n", "lock", "acquisitions", "spins", "parks");
+  for (auto& s : names) {
+    std::fprintf(out, "%-16s %14lu %14lu %10lu\n", s.name, s.acquisitions, s.spins, s.parks);
+  }
+
+  constexpr size_t TopN = 8;
+  std::sort(live.begin(), live.end(), by_contention);
+  live.resize(std::min(live.size(), TopN));
+  if (!live.empty()) {
+    std::fprintf(out, "most contended live locks:\n");
+  }
+  for (auto& s : live) {
+    std::fprintf(out, "%-16s %p %14lu %14lu %10lu\n", s.name, s.lock, s.acquisitions, s.spins, s.parks);
+  }
+}
+
+void Spinlock::_lock_slow() {
+  uint32_t hint = _spin_hint.load(std::memory_order_relaxed);
+  uint32_t limit = multi_core ? std::min(MaxSpins, hint * 2 + MinSpins) : 0;
+  uint32_t spins = 0;
+  uint32_t backoff = 1;
+  bool locked = false;
+  while (spins < limit) {
+    if (_state.load(std::memory_order_relaxed) == Unlocked) {
+      uint32_t expected = Unlocked;
+      if (_state.compare_exchange_weak(expected, Locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+        locked = true;
+        break;
+      }
+    }
+    for (uint32_t i = 0; i < backoff; ++i) {
+      cpu_relax();
+    }
+    spins += backoff;
+    backoff = std::min(backoff * 2, MaxBackoff);
+  }
+
+  size_t parks = 0;
+  if (locked) {
+    _spin_hint.store(hint + (int32_t(spins) - int32_t(hint)) / 8, std::memory_order_relaxed);
+  } else {
+    // the lock may be released without a wakeup once it is contended, so a parked waiter marks it before sleeping
+    while (_state.exchange(Contended, std::memory_order_acquire) != Unlocked) {
+      ++parks;
+      _park();
+    }
+    _spin_hint.store(hint - hint / 8, std::memory_order_relaxed);
+  }
+#if defined(CGO_LOCK_STATS)
+  _spins.store(_spins.load(std::memory_order_relaxed) + spins, std::memory_order_relaxed);
+  _parks.store(_parks.load(std::memory_order_relaxed) + parks, std::memory_order_relaxed);
+#endif
+}
+
+void Spinlock::_park() {
+#if defined(linux) || defined(__linux) || defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_state), FUTEX_WAIT_PRIVATE, Contended, nullptr, nullptr, 0);
+#else
+  _state.wait(Contended, std::memory_order_relaxed);
+#endif
+}
+
+void Spinlock::_unpark() {
+#if defined(linux) || defined(__linux) || defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+  _state.notify_one();
+#endif
+}
+
+}  // namespace cgo::_impl
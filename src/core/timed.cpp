@@ -1,88 +1,424 @@
 #include "core/timed.h"
 
+#include <algorithm>
+#include <bit>
+#include <thread>
+#include <utility>
+
 namespace cgo::_impl {
 
-void TimedContext::create_timeout(std::function<void()>&& fn, std::chrono::duration<double, std::milli> timeout) {
+TimedContext::TimedContext(size_t n_partition, TimerBackend backend, std::chrono::nanoseconds tick) {
+  for (size_t i = 0; i < n_partition; ++i) {
+    if (backend == TimerBackend::Wheel) {
+      _schedulers.emplace_back(std::make_unique<WheelScheduler>(tick));
+    } else {
+      _schedulers.emplace_back(std::make_unique<HeapScheduler>());
+    }
+  }
+}
+
+auto TimedContext::create_timeout(std::function<void()>&& fn, std::chrono::duration<double, std::milli> timeout,
+                                  std::chrono::duration<double, std::milli> slack) -> Handle {
+  size_t id = this->_tid.fetch_add(1);
+  size_t slot = id % this->_schedulers.size();
+  auto ex_tp = _deadline(timeout, slack);
+  return this->_schedulers[slot]->push(std::forward<decltype(fn)>(fn), ex_tp);
+}
+
+auto TimedContext::create_periodic(std::function<void()>&& fn, std::chrono::duration<double, std::milli> period)
+    -> Handle {
   size_t id = this->_tid.fetch_add(1);
   size_t slot = id % this->_schedulers.size();
-  auto steady_timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
-  auto ex_tp = std::chrono::steady_clock::now() + steady_timeout;
-  this->_schedulers[slot].push(Task{id, std::forward<decltype(fn)>(fn), ex_tp});
+  auto steady_period = std::max<std::chrono::steady_clock::duration>(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(period), std::chrono::nanoseconds(1));
+  return this->_schedulers[slot]->push(std::move(fn), LoopClock::now() + steady_period, steady_period);
 }
 
 size_t TimedContext::run_timeout(size_t pindex, size_t batch_size) {
+  std::vector<Timer*> timers;
+  auto now = LoopClock::now();
   size_t cnt = 0;
-  for (size_t slot = pindex % this->_schedulers.size(); cnt < batch_size;) {
-    auto task = this->_schedulers[slot].pop();
-    if (task) {
-      task->fn();
-      ++cnt;
-    } else {
-      break;
+  for (size_t i = 0; i < _schedulers.size() && cnt < batch_size; ++i) {
+    auto& scheduler = _schedulers[(pindex + i) % _schedulers.size()];
+    if (scheduler->pop(now, batch_size - cnt, timers) == 0) {
+      continue;
     }
-  }
-  if (cnt == batch_size) {
-    return cnt;
-  }
-  for (size_t i = 0; i < this->_schedulers.size(); ++i) {
-    size_t slot = (pindex + i) % this->_schedulers.size();
-    if (auto task = this->_schedulers[slot].pop(); task) {
-      task->fn();
-      ++cnt;
-      if (cnt == batch_size) {
-        break;
+    // callbacks run outside of the scheduler lock, they may create or cancel timers
+    _batch = &timers;
+    for (_batch_pos = 0; _batch_pos < timers.size(); ++_batch_pos) {
+      if (auto timer = timers[_batch_pos]; timer->fn) {
+        timer->fn();
       }
     }
+    _batch = nullptr;
+    cnt += timers.size();
+    scheduler->finish(now, timers);
+    timers.clear();
   }
   return cnt;
 }
 
+auto TimedContext::_deadline(std::chrono::duration<double, std::milli> timeout,
+                             std::chrono::duration<double, std::milli> slack) -> TimePoint {
+  auto ex = LoopClock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+  auto window = std::chrono::duration_cast<std::chrono::steady_clock::duration>(slack);
+  if (window.count() <= 0) {
+    return ex;
+  }
+  // round up, a deadline is never early
+  auto since_epoch = ex.time_since_epoch();
+  auto rem = since_epoch % window;
+  return rem.count() == 0 ? ex : ex + (window - rem);
+}
+
 auto TimedContext::next_schedule_time(size_t pindex) -> TimedContext::TimePoint {
-  size_t slot = pindex % _schedulers.size();
-  auto& scheduler = _schedulers[slot];
-  {
-    std::unique_lock guard(scheduler._mtx);
-    if (scheduler._pq_timer.empty()) {
-      return TimePoint::max();
+  return _schedulers[pindex % _schedulers.size()]->next_time();
+}
+
+size_t TimedContext::size() {
+  size_t n = 0;
+  for (auto& scheduler : _schedulers) {
+    n += scheduler->size();
+  }
+  return n;
+}
+
+auto TimedContext::Scheduler::push(Callback&& fn, TimePoint ex, std::chrono::steady_clock::duration period)
+    -> Handle {
+  std::unique_lock guard(_mtx);
+  auto timer = _alloc();
+  timer->fn = std::move(fn);
+  timer->ex = ex;
+  timer->period = period;
+  _arm(timer);
+  return Handle(this, timer, timer->generation);
+}
+
+bool TimedContext::Scheduler::cancel(Timer* timer, uint32_t generation) {
+  Callback fn;
+  while (true) {
+    std::unique_lock guard(_mtx);
+    if (timer->generation != generation) {
+      return false;
+    }
+    size_t pos = _batch ? std::find(_batch->begin(), _batch->end(), timer) - _batch->begin() : 0;
+    if (_batch && pos < _batch->size()) {
+      // in the batch this thread is firing, waiting for it would never end. It is left to `finish()`
+      bool periodic = std::exchange(timer->period, {}) != std::chrono::steady_clock::duration::zero();
+      if (pos <= _batch_pos) {
+        // fired already, or cancelled by its own callback, only a periodic timer has anything left to stop
+        return periodic;
+      }
+      // skipped by `run_timeout()`
+      fn = std::move(timer->fn);
+      timer->fn = nullptr;
+      return true;
+    }
+    if (!timer->firing) {
+      _remove(timer);
+      // captures are destroyed outside of the lock
+      fn = std::move(timer->fn);
+      _release(timer);
+      --_size;
+      return true;
     }
-    return scheduler._pq_timer.top().ex;
+    guard.unlock();
+    std::this_thread::yield();
   }
 }
 
-void TimedContext::Scheduler::push(Task&& timer) {
+size_t TimedContext::Scheduler::pop(TimePoint now, size_t batch_size, std::vector<Timer*>& timers) {
   std::unique_lock guard(_mtx);
-  if (_pq_timer.empty() || timer < _pq_timer.top()) {
-    if (_signal) {
-      _signal->emit();
+  size_t cnt = 0;
+  for (; cnt < batch_size; ++cnt) {
+    auto timer = _pop(now);
+    if (!timer) {
+      break;
+    }
+    timer->firing = true;
+    timers.push_back(timer);
+    --_size;
+  }
+  return cnt;
+}
+
+void TimedContext::Scheduler::finish(TimePoint now, std::vector<Timer*>& timers) {
+  for (auto timer : timers) {
+    if (timer->period == std::chrono::steady_clock::duration::zero()) {
+      timer->fn = nullptr;
     }
   }
-  _pq_timer.push(std::forward<Task>(timer));
+  std::unique_lock guard(_mtx);
+  for (auto timer : timers) {
+    timer->firing = false;
+    if (timer->period == std::chrono::steady_clock::duration::zero()) {
+      // one-shot, or stopped by its own callback
+      _release(timer);
+      continue;
+    }
+    timer->ex += timer->period;
+    if (timer->ex <= now) {
+      timer->ex += (now - timer->ex) / timer->period * timer->period + timer->period;
+    }
+    _arm(timer);
+  }
+}
+
+auto TimedContext::Scheduler::next_time() -> TimePoint {
+  std::unique_lock guard(_mtx);
+  return _next();
 }
 
-auto TimedContext::Scheduler::pop() -> std::optional<Task> {
+size_t TimedContext::Scheduler::size() {
   std::unique_lock guard(_mtx);
-  if (!_pq_timer.empty() && std::chrono::steady_clock::now() >= _pq_timer.top().ex) {
-    auto timer = std::move(const_cast<Task&>(_pq_timer.top()));
-    _pq_timer.pop();
-    return timer;
+  return _size;
+}
+
+auto TimedContext::Scheduler::_alloc() -> Timer* {
+  if (!_free) {
+    auto& chunk = _chunks.emplace_back(std::make_unique<Timer[]>(ChunkSize));
+    for (size_t i = ChunkSize; i > 0; --i) {
+      chunk[i - 1].next = _free;
+      _free = &chunk[i - 1];
+    }
+  }
+  auto timer = _free;
+  _free = timer->next;
+  timer->prev = timer->next = nullptr;
+  return timer;
+}
+
+void TimedContext::Scheduler::_arm(Timer* timer) {
+  if (timer->ex < _next() && _signal) {
+    _signal->emit();
+  }
+  _insert(timer);
+  ++_size;
+}
+
+void TimedContext::Scheduler::_release(Timer* timer) {
+  timer->fn = nullptr;
+  timer->period = {};
+  ++timer->generation;
+  timer->prev = nullptr;
+  timer->next = _free;
+  _free = timer;
+}
+
+void TimedContext::HeapScheduler::_insert(Timer* timer) {
+  _heap.push_back(timer);
+  _place(timer, _heap.size() - 1);
+  _sift_up(timer->pos);
+}
+
+void TimedContext::HeapScheduler::_remove(Timer* timer) {
+  size_t pos = timer->pos;
+  auto last = _heap.back();
+  _heap.pop_back();
+  if (last == timer) {
+    return;
+  }
+  _place(last, pos);
+  _sift_up(pos);
+  _sift_down(last->pos);
+}
+
+auto TimedContext::HeapScheduler::_pop(TimePoint now) -> Timer* {
+  if (_heap.empty() || _heap.front()->ex > now) {
+    return nullptr;
+  }
+  auto timer = _heap.front();
+  _remove(timer);
+  return timer;
+}
+
+auto TimedContext::HeapScheduler::_next() -> TimePoint { return _heap.empty() ? TimePoint::max() : _heap.front()->ex; }
+
+void TimedContext::HeapScheduler::_place(Timer* timer, size_t pos) {
+  _heap[pos] = timer;
+  timer->pos = pos;
+}
+
+void TimedContext::HeapScheduler::_sift_up(size_t pos) {
+  auto timer = _heap[pos];
+  while (pos > 0) {
+    size_t parent = (pos - 1) / 2;
+    if (_heap[parent]->ex <= timer->ex) {
+      break;
+    }
+    _place(_heap[parent], pos);
+    pos = parent;
+  }
+  _place(timer, pos);
+}
+
+void TimedContext::HeapScheduler::_sift_down(size_t pos) {
+  auto timer = _heap[pos];
+  while (true) {
+    size_t child = 2 * pos + 1;
+    if (child >= _heap.size()) {
+      break;
+    }
+    if (child + 1 < _heap.size() && _heap[child + 1]->ex < _heap[child]->ex) {
+      ++child;
+    }
+    if (timer->ex <= _heap[child]->ex) {
+      break;
+    }
+    _place(_heap[child], pos);
+    pos = child;
+  }
+  _place(timer, pos);
+}
+
+void TimedContext::WheelScheduler::_insert(Timer* timer) {
+  uint64_t when = _deadline_tick(timer->ex);
+  if (when <= _elapsed) {
+    timer->pos = ExpiredLevel;
+  } else {
+    when = std::min(when, _elapsed + MaxTick);
+    // highest 6-bit digit in which the deadline differs from now
+    uint64_t masked = std::min((_elapsed ^ when) | (LevelSlots - 1), MaxTick);
+    timer->pos = (63 - std::countl_zero(masked)) / LevelBits;
+    timer->tick = when;
+    _levels[timer->pos].occupied |= uint64_t(1) << ((when >> (timer->pos * LevelBits)) % LevelSlots);
+  }
+  auto& head = _head(timer);
+  timer->prev = nullptr;
+  timer->next = head;
+  if (head) {
+    head->prev = timer;
+  }
+  head = timer;
+}
+
+void TimedContext::WheelScheduler::_remove(Timer* timer) {
+  auto& head = _head(timer);
+  if (timer->prev) {
+    timer->prev->next = timer->next;
+  } else {
+    head = timer->next;
+  }
+  if (timer->next) {
+    timer->next->prev = timer->prev;
+  }
+  if (!head && timer->pos != ExpiredLevel) {
+    _levels[timer->pos].occupied &= ~(uint64_t(1) << ((timer->tick >> (timer->pos * LevelBits)) % LevelSlots));
+  }
+  timer->prev = timer->next = nullptr;
+}
+
+auto TimedContext::WheelScheduler::_pop(TimePoint now) -> Timer* {
+  uint64_t now_tick = std::max<int64_t>((now - _start) / _tick, 0);
+  while (!_expired) {
+    size_t level = 0;
+    size_t slot = 0;
+    uint64_t deadline = 0;
+    if (!_next_slot(level, slot, deadline) || deadline > now_tick) {
+      _elapsed = std::max(_elapsed, now_tick);
+      return nullptr;
+    }
+    _expire_slot(level, slot, deadline);
+  }
+  auto timer = _expired;
+  _remove(timer);
+  return timer;
+}
+
+auto TimedContext::WheelScheduler::_next() -> TimePoint {
+  if (_expired) {
+    return _start + int64_t(_elapsed) * _tick;
+  }
+  size_t level = 0;
+  size_t slot = 0;
+  uint64_t deadline = 0;
+  if (!_next_slot(level, slot, deadline)) {
+    return TimePoint::max();
+  }
+  return _start + int64_t(deadline) * _tick;
+}
+
+auto TimedContext::WheelScheduler::_deadline_tick(TimePoint ex) -> uint64_t {
+  if (ex <= _start) {
+    return 0;
+  }
+  // round up, a timer never fires before its deadline
+  return (ex - _start + _tick - std::chrono::nanoseconds(1)) / _tick;
+}
+
+auto TimedContext::WheelScheduler::_head(Timer* timer) -> Timer*& {
+  if (timer->pos == ExpiredLevel) {
+    return _expired;
+  }
+  return _levels[timer->pos].slots[(timer->tick >> (timer->pos * LevelBits)) % LevelSlots];
+}
+
+bool TimedContext::WheelScheduler::_next_slot(size_t& level, size_t& slot, uint64_t& deadline) {
+  for (level = 0; level < LevelNum; ++level) {
+    uint64_t occupied = _levels[level].occupied;
+    if (!occupied) {
+      continue;
+    }
+    size_t shift = level * LevelBits;
+    size_t now_slot = (_elapsed >> shift) % LevelSlots;
+    slot = (std::countr_zero(std::rotr(occupied, now_slot)) + now_slot) % LevelSlots;
+    uint64_t level_range = uint64_t(1) << (shift + LevelBits);
+    deadline = (_elapsed & ~(level_range - 1)) + (uint64_t(slot) << shift);
+    if (deadline <= _elapsed) {
+      // only on the top level, the slot wraps around
+      deadline += level_range;
+    }
+    return true;
+  }
+  return false;
+}
+
+void TimedContext::WheelScheduler::_expire_slot(size_t level, size_t slot, uint64_t deadline) {
+  auto timer = std::exchange(_levels[level].slots[slot], nullptr);
+  _levels[level].occupied &= ~(uint64_t(1) << slot);
+  _elapsed = deadline;
+  while (timer) {
+    auto next = timer->next;
+    // expired ones go to the expired list, the others down to a lower level
+    _insert(timer);
+    timer = next;
+  }
+}
+
+bool TimedContext::Handle::cancel() {
+  if (!_timer) {
+    return false;
+  }
+  return _scheduler->cancel(std::exchange(_timer, nullptr), _generation);
+}
+
+Sleeper::~Sleeper() { _timer.cancel(); }
+
+bool Sleeper::await_suspend(std::coroutine_handle<> caller) {
+  if (&SchedContext::this_coroutine_ctx() != _ctx) {
+    // timers of another context may fire after this coroutine is destroyed by its own context shutdown, and can not
+    // be cancelled then, since the other context may be destroyed already
+    _shared = std::make_shared<Semaphore>(0);
+    TimedContext::at(*_ctx).create_timeout([signal = _shared]() { signal->release(); }, _timeout);
+    return _shared->aquire().await_suspend(caller);
   }
-  return std::nullopt;
+  _timer = TimedContext::at(*_ctx).create_timeout([this]() { _signal.release(); }, _timeout);
+  return _signal.aquire().await_suspend(caller);
 }
 
 }  // namespace cgo::_impl
 
 namespace cgo {
 
-Channel<Nil> timeout(Context& ctx, std::chrono::duration<double, std::milli> timeout) {
+Channel<Nil> timeout(Context& ctx, std::chrono::duration<double, std::milli> timeout,
+                     std::chrono::duration<double, std::milli> slack) {
   Channel<Nil> chan(1);
-  _impl::TimedContext::at(ctx).create_timeout([chan]() mutable { chan.nowait() << Nil{}; }, timeout);
+  _impl::TimedContext::at(ctx).create_timeout([chan]() mutable { chan.nowait() << Nil{}; }, timeout, slack);
   return chan;
 }
 
-Coroutine<void> sleep(Context& ctx, std::chrono::duration<double, std::milli> timeout) {
-  auto signal = std::make_shared<Semaphore>(0);
-  _impl::TimedContext::at(ctx).create_timeout([signal]() { signal->release(); }, timeout);
-  co_await signal->aquire();
+Ticker::Ticker(Context& ctx, std::chrono::duration<double, std::milli> period) {
+  _timer = _impl::TimedContext::at(ctx).create_periodic([chan = _chan]() { chan.nowait() << now(); }, period);
 }
 
 }  // namespace cgo
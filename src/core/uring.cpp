@@ -0,0 +1,597 @@
+#include "core/uring.h"
+
+#include "core/timed.h"
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace cgo::_impl {
+
+static int uring_setup(unsigned entries, ::io_uring_params* params) {
+  return ::syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+  return ::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+namespace {
+
+struct Probe {
+  bool ok = false;
+  std::string reason;
+};
+
+}  // namespace
+
+static auto probe() -> const Probe& {
+  static const Probe probed = []() -> Probe {
+    ::io_uring_params params = {};
+    int fd = uring_setup(4, &params);
+    if (fd < 0) {
+      return {false, std::string("io_uring_setup: ") + ::strerror(errno)};
+    }
+    ::close(fd);
+    uint32_t required = IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+    if ((params.features & required) != required) {
+      return {false, "no IORING_FEAT_NODROP or IORING_FEAT_FAST_POLL"};
+    }
+
+    // multishot recv into provided buffers is the newest of what is used (6.0), try it on a socket pair
+    struct Recv : public Uring::Request {
+      int res = 0;
+      uint32_t flags = 0;
+      bool done = false;
+
+      void complete(int res, uint32_t flags) override {
+        this->res = res;
+        this->flags = flags;
+        done = true;
+      }
+    };
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+      return {false, std::string("socketpair: ") + ::strerror(errno)};
+    }
+    Probe res;
+    try {
+      Uring ring(4);
+      Recv recv;
+      ring.push(&recv, [&fds](::io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_RECV;
+        sqe.fd = fds[0];
+        sqe.ioprio = IORING_RECV_MULTISHOT;
+        sqe.flags = IOSQE_BUFFER_SELECT;
+        sqe.buf_group = Uring::BufferGroup;
+      });
+      char c = 0;
+      ::write(fds[1], &c, 1);
+      ::pollfd pfd = {ring.fd(), POLLIN, 0};
+      ::poll(&pfd, 1, 100);
+      ring.run(1);
+      res.ok = recv.done && recv.res == 1 && (recv.flags & IORING_CQE_F_MORE);
+      if (!recv.done) {
+        res.reason = "multishot recv into provided buffers: no completion";
+      } else if (recv.res < 0) {
+        res.reason = std::string("multishot recv into provided buffers: ") + ::strerror(-recv.res);
+      } else if (!res.ok) {
+        res.reason = "multishot recv into provided buffers: not kept armed";
+      }
+    } catch (const std::runtime_error& e) {
+      res.reason = e.what();
+    }
+    // the ring is closed already, which cancels the probe
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return res;
+  }();
+  return probed;
+}
+
+bool Uring::supported() { return probe().ok; }
+
+auto Uring::unsupported_reason() -> const std::string& { return probe().reason; }
+
+Uring::Uring(unsigned entries) {
+  ::io_uring_params params = {};
+  params.flags = IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL;
+  _fd = uring_setup(entries, &params);
+  if (_fd < 0) {
+    throw std::runtime_error(std::string("io_uring_setup: ") + ::strerror(errno));
+  }
+
+  _sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(::io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+  }
+  _sq_ptr = ::mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+  _cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP)
+                ? _sq_ptr
+                : ::mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+  _sqes_size = params.sq_entries * sizeof(::io_uring_sqe);
+  void* sqes = ::mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+  if (_sq_ptr == MAP_FAILED || _cq_ptr == MAP_FAILED || sqes == MAP_FAILED) {
+    int err = errno;
+    _sq_ptr = _sq_ptr == MAP_FAILED ? nullptr : _sq_ptr;
+    _cq_ptr = _cq_ptr == MAP_FAILED ? nullptr : _cq_ptr;
+    _sqes = sqes == MAP_FAILED ? nullptr : static_cast<::io_uring_sqe*>(sqes);
+    _release();
+    throw std::runtime_error(std::string("io_uring mmap: ") + ::strerror(err));
+  }
+
+  auto sq = static_cast<char*>(_sq_ptr);
+  _sq_entries = params.sq_entries;
+  _sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+  _sq_head = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.head);
+  _sq_tail = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.tail);
+  _sq_flags = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.flags);
+  _sqes = static_cast<::io_uring_sqe*>(sqes);
+  _sq_local_tail = _sq_tail->load(std::memory_order_relaxed);
+  // SQEs are used in ring order, so the indirection array is filled once
+  auto array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+  for (uint32_t i = 0; i < _sq_entries; ++i) {
+    array[i] = i;
+  }
+
+  auto cq = static_cast<char*>(_cq_ptr);
+  _cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+  _cq_head = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.head);
+  _cq_tail = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.tail);
+  _cqes = reinterpret_cast<::io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  _setup_buffer_ring();
+}
+
+Uring::~Uring() { _release(); }
+
+void Uring::_release() {
+  if (_bufs) {
+    ::io_uring_buf_reg reg = {};
+    reg.bgid = BufferGroup;
+    uring_register(_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    ::munmap(_bufs, BufferNum * sizeof(::io_uring_buf));
+  }
+  if (_sqes) {
+    ::munmap(_sqes, _sqes_size);
+  }
+  if (_cq_ptr && _cq_ptr != _sq_ptr) {
+    ::munmap(_cq_ptr, _cq_size);
+  }
+  if (_sq_ptr) {
+    ::munmap(_sq_ptr, _sq_size);
+  }
+  ::close(_fd);
+}
+
+void Uring::cancel(int fd) {
+  std::unique_lock guard(_mtx);
+  auto sqe = _sqe(guard, 1);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  _commit(1, 0);
+  _submit();
+}
+
+void Uring::cancel(Request* req) {
+  push(nullptr, [req](::io_uring_sqe& sqe) {
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = -1;
+    sqe.addr = reinterpret_cast<uint64_t>(req);
+  });
+}
+
+void Uring::recycle(uint16_t bid) {
+  std::unique_lock guard(_buf_mtx);
+  // entries start at the ring itself. In C++, `bufs` of older uapi headers sits 8 bytes further, behind the empty
+  // struct `__DECLARE_FLEX_ARRAY` puts in front of it, and the kernel would see no buffer at all
+  auto& buf = reinterpret_cast<::io_uring_buf*>(_bufs)[_buf_tail & (BufferNum - 1)];
+  buf.addr = reinterpret_cast<uint64_t>(buffer(bid));
+  buf.len = BufferSize;
+  buf.bid = bid;
+  ++_buf_tail;
+  std::atomic_ref(_bufs->tail).store(_buf_tail, std::memory_order_release);
+}
+
+size_t Uring::run(size_t batch_size) {
+  {
+    std::unique_lock guard(_mtx);
+    if (_unsubmitted > 0 || (_sq_flags->load(std::memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW)) {
+      _submit();
+    }
+  }
+
+  size_t n = 0;
+  // stashed ones were posted first, completions may stash more
+  while (!_stashed.empty() && n < batch_size) {
+    auto cqe = _stashed.front();
+    _stashed.pop_front();
+    ++n;
+    _complete(cqe);
+  }
+  uint32_t head = _cq_head->load(std::memory_order_relaxed);
+  uint32_t tail = _cq_tail->load(std::memory_order_acquire);
+  while (head != tail && n < batch_size && _stashed.empty()) {
+    auto cqe = _cqes[head & _cq_mask];
+    // the slot is free once copied, completions may queue more requests
+    _cq_head->store(++head, std::memory_order_release);
+    ++n;
+    _complete(cqe);
+  }
+  return n;
+}
+
+void Uring::drain() {
+  while (_inflight.load() > 0) {
+    push(nullptr, [](::io_uring_sqe& sqe) {
+      sqe.opcode = IORING_OP_ASYNC_CANCEL;
+      sqe.fd = -1;
+      sqe.cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+    });
+    run(-1);
+    if (_inflight.load() > 0) {
+      ::pollfd pfd = {_fd, POLLIN, 0};
+      ::poll(&pfd, 1, 10);
+      run(-1);
+    }
+  }
+}
+
+auto Uring::_sqe(std::unique_lock<Spinlock>& guard, uint32_t n) -> ::io_uring_sqe* {
+  while (_sq_local_tail + n - _sq_head->load(std::memory_order_acquire) > _sq_entries) {
+    if (_submit()) {
+      continue;
+    }
+    if (_local == this) {
+      // nobody else reaps, complete them later
+      _stash();
+    } else {
+      guard.unlock();
+      std::this_thread::yield();
+      guard.lock();
+    }
+  }
+  for (uint32_t i = 0; i < n; ++i) {
+    ::memset(_sqe_at(_sq_local_tail + i), 0, sizeof(::io_uring_sqe));
+  }
+  return _sqe_at(_sq_local_tail);
+}
+
+void Uring::_commit(uint32_t n, size_t requests) {
+  _sq_local_tail += n;
+  _sq_tail->store(_sq_local_tail, std::memory_order_release);
+  _unsubmitted += n;
+  _inflight.fetch_add(requests, std::memory_order_relaxed);
+  if (_local != this) {
+    // the owner may be parked, nobody else would submit it soon
+    _submit();
+  }
+}
+
+bool Uring::_submit() {
+  unsigned flags = 0;
+  if (_sq_flags->load(std::memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW) {
+    // completions held back by the kernel are flushed into the CQ
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+  while (_unsubmitted > 0 || flags) {
+    int ret = uring_enter(_fd, _unsubmitted, 0, flags);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EBUSY) {
+        // retried by the next submit, once completions are reaped
+        return false;
+      }
+      throw std::runtime_error(std::string("io_uring_enter: ") + ::strerror(errno));
+    }
+    _unsubmitted -= std::min<uint32_t>(ret, _unsubmitted);
+    if (ret == 0) {
+      return true;
+    }
+    flags = 0;
+  }
+  return true;
+}
+
+void Uring::_stash() {
+  uint32_t head = _cq_head->load(std::memory_order_relaxed);
+  uint32_t tail = _cq_tail->load(std::memory_order_acquire);
+  if (head == tail) {
+    std::this_thread::yield();
+    return;
+  }
+  while (head != tail) {
+    _stashed.push_back(_cqes[head & _cq_mask]);
+    ++head;
+  }
+  _cq_head->store(head, std::memory_order_release);
+}
+
+void Uring::_complete(const ::io_uring_cqe& cqe) {
+  if (cqe.user_data & LinkTimeoutTag) {
+    _inflight.fetch_sub(1, std::memory_order_relaxed);
+    reinterpret_cast<Request*>(cqe.user_data & ~LinkTimeoutTag)->link_timeout(cqe.res);
+    return;
+  }
+  auto req = reinterpret_cast<Request*>(cqe.user_data);
+  if (!req) {
+    return;
+  }
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    _inflight.fetch_sub(1, std::memory_order_relaxed);
+  }
+  req->complete(cqe.res, cqe.flags);
+}
+
+void Uring::_setup_buffer_ring() {
+  size_t size = BufferNum * sizeof(::io_uring_buf);
+  void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    int err = errno;
+    _release();
+    throw std::runtime_error(std::string("io_uring buffer ring: ") + ::strerror(err));
+  }
+  ::io_uring_buf_reg reg = {};
+  reg.ring_addr = reinterpret_cast<uint64_t>(ptr);
+  reg.ring_entries = BufferNum;
+  reg.bgid = BufferGroup;
+  if (uring_register(_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    int err = errno;
+    ::munmap(ptr, size);
+    _release();
+    throw std::runtime_error(std::string("io_uring buffer ring: ") + ::strerror(err));
+  }
+  _bufs = static_cast<::io_uring_buf_ring*>(ptr);
+  _buffers.reset(new char[size_t(BufferNum) * BufferSize]);
+  for (uint32_t bid = 0; bid < BufferNum; ++bid) {
+    recycle(bid);
+  }
+}
+
+UringContext::UringContext(size_t n_partition) {
+  for (size_t i = 0; i < n_partition; ++i) {
+    _rings.emplace_back(std::make_shared<Uring>());
+  }
+}
+
+auto UringContext::ring_for(int fd) -> const std::shared_ptr<Uring>& {
+  if (auto local = Uring::local()) {
+    for (auto& ring : _rings) {
+      if (ring.get() == local) {
+        return ring;
+      }
+    }
+  }
+  return _rings[fd % _rings.size()];
+}
+
+void UringContext::cancel(int fd) {
+  for (auto& ring : _rings) {
+    ring->cancel(fd);
+  }
+}
+
+auto UringOp::timeout(std::chrono::duration<double, std::milli> timeout) -> const __kernel_timespec* {
+  if (timeout.count() <= 0) {
+    return nullptr;
+  }
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+  _ts.tv_sec = ns / 1000000000;
+  _ts.tv_nsec = ns % 1000000000;
+  _pending = 2;
+  return &_ts;
+}
+
+UringSocket::~UringSocket() {
+  for (auto& chunk : _chunks) {
+    _recv_ring->recycle(chunk.bid);
+  }
+  for (int fd : _accepted) {
+    ::close(fd);
+  }
+}
+
+Coroutine<int> UringSocket::accept(UringContext& uring) {
+  while (true) {
+    std::shared_ptr<Waiter> waiter;
+    {
+      std::unique_lock guard(_mtx);
+      if (!_accepted.empty()) {
+        int fd = _accepted.front();
+        _accepted.pop_front();
+        co_return fd;
+      }
+      if (_accept_error) {
+        co_return -std::exchange(_accept_error, 0);
+      }
+      if (!_acceptor.armed) {
+        _arm(*uring.ring_for(_fd), _acceptor);
+      }
+      waiter = _waiters.emplace_back(std::make_shared<Waiter>());
+    }
+    co_await waiter->signal.aquire();
+  }
+}
+
+Coroutine<int> UringSocket::recv(Context& ctx, UringContext& uring, std::span<const ::iovec> iov,
+                                 std::chrono::duration<double, std::milli> timeout,
+                                 std::chrono::duration<double, std::milli> slack) {
+  while (true) {
+    std::shared_ptr<Waiter> waiter;
+    {
+      std::unique_lock guard(_mtx);
+      if (!_chunks.empty()) {
+        size_t n = 0;
+        size_t off = 0;
+        for (size_t i = 0; i < iov.size() && !_chunks.empty();) {
+          auto& chunk = _chunks.front();
+          size_t len = std::min<size_t>(iov[i].iov_len - off, chunk.len - chunk.off);
+          ::memcpy(static_cast<char*>(iov[i].iov_base) + off, _recv_ring->buffer(chunk.bid) + chunk.off, len);
+          n += len;
+          off += len;
+          chunk.off += len;
+          if (chunk.off == chunk.len) {
+            _recv_ring->recycle(chunk.bid);
+            _chunks.pop_front();
+          }
+          if (off == iov[i].iov_len) {
+            ++i;
+            off = 0;
+          }
+        }
+        co_return n;
+      }
+      if (_recv_error) {
+        co_return -_recv_error;
+      }
+      if (_eof) {
+        co_return 0;
+      }
+      if (!_starved) {
+        if (!_receiver.armed) {
+          if (!_recv_ring) {
+            _recv_ring = uring.ring_for(_fd);
+          }
+          _arm(*_recv_ring, _receiver);
+        }
+        waiter = _waiters.emplace_back(std::make_shared<Waiter>());
+      }
+      _starved = false;
+    }
+
+    if (!waiter) {
+      // every provided buffer is held by unread data, receive into `iov` once before arming again
+      ::msghdr msg = {};
+      msg.msg_iov = const_cast<::iovec*>(iov.data());
+      msg.msg_iovlen = iov.size();
+      UringOp op;
+      uring.ring_for(_fd)->push(&op, op.timeout(timeout), [&](::io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_RECVMSG;
+        sqe.fd = _fd;
+        sqe.addr = reinterpret_cast<uint64_t>(&msg);
+        sqe.len = 1;
+      });
+      co_await op.wait();
+      co_return op.result();
+    }
+
+    TimedContext::Handle timer;
+    if (timeout.count() > 0) {
+      timer = TimedContext::at(ctx).create_timeout([waiter]() { _wake(*waiter, -1); }, timeout, slack);
+    }
+    co_await waiter->signal.aquire();
+    if (waiter->state == 1) {
+      timer.cancel();
+      continue;
+    }
+    std::unique_lock guard(_mtx);
+    std::erase(_waiters, waiter);
+    co_return -ETIME;
+  }
+}
+
+bool UringSocket::buffering() {
+  std::unique_lock guard(_mtx);
+  return _receiver.armed || !_chunks.empty() || _eof || _recv_error;
+}
+
+size_t UringSocket::held() {
+  std::unique_lock guard(_mtx);
+  return _chunks.size();
+}
+
+void UringSocket::_arm(Uring& ring, Stream& stream) {
+  stream.armed = true;
+  stream.keepalive = shared_from_this();
+  ring.push(&stream, [this, &stream](::io_uring_sqe& sqe) {
+    sqe.fd = _fd;
+    if (stream.accept) {
+      sqe.opcode = IORING_OP_ACCEPT;
+      sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+      sqe.accept_flags = SOCK_CLOEXEC;
+    } else {
+      sqe.opcode = IORING_OP_RECV;
+      sqe.ioprio = IORING_RECV_MULTISHOT;
+      sqe.flags = IOSQE_BUFFER_SELECT;
+      sqe.buf_group = Uring::BufferGroup;
+    }
+  });
+}
+
+void UringSocket::_wake(Waiter& waiter, int state) {
+  int expected = 0;
+  if (waiter.state.compare_exchange_strong(expected, state)) {
+    waiter.signal.release();
+  }
+}
+
+void UringSocket::Stream::complete(int res, uint32_t flags) {
+  std::shared_ptr<UringSocket> last;  // declared first, so the state outlives everything below
+  std::vector<std::shared_ptr<Waiter>> waiters;
+  auto& s = *owner;
+  {
+    std::unique_lock guard(s._mtx);
+    if (!(flags & IORING_CQE_F_MORE)) {
+      armed = false;
+      last = std::move(keepalive);
+    }
+    if (accept) {
+      if (res >= 0) {
+        s._accepted.push_back(res);
+      } else {
+        s._accept_error = -res;
+      }
+    } else {
+      if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0) {
+          s._chunks.push_back({bid, uint32_t(res)});
+        } else {
+          s._recv_ring->recycle(bid);
+        }
+      }
+      if (res == 0) {
+        s._eof = true;
+      } else if (res == -ENOBUFS) {
+        s._starved = true;
+      } else if (res < 0 && !(res == -ECANCELED && s._paused)) {
+        s._recv_error = -res;
+      }
+      if (!armed) {
+        s._paused = false;
+      } else if (s._chunks.size() >= MaxChunks && !s._paused) {
+        // re-armed by a reader once the chunks are consumed
+        s._paused = true;
+        s._recv_ring->cancel(this);
+      }
+    }
+    waiters.swap(s._waiters);
+  }
+  for (auto& waiter : waiters) {
+    _wake(*waiter, 1);
+  }
+}
+
+}  // namespace cgo::_impl
+
+#endif
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <optional>
 #include <queue>
 #include <variant>
 
@@ -87,7 +89,7 @@ class BaseChannel {
   auto recv_from(BaseMsg* src, bool oneshot = false) -> TransferStatus;
 
  protected:
-  Spinlock _mtx;
+  Spinlock _mtx{"channel"};
   BaseMsg _sender_head, _sender_tail;
   BaseMsg _recver_head, _recver_tail;
 
@@ -128,6 +130,53 @@ class TypeChannel : public BaseChannel {
   }
 };
 
+/**
+ * @brief Blocking send or recv on a channel. The message and its signal live inside the awaiter, i.e. inside the frame
+ *
+ *        of the awaiting coroutine, so no extra frame is allocated
+ */
+template <typename T>
+class TypeMsgAwaiter {
+ public:
+  TypeMsgAwaiter(TypeChannel<T>* chan, T* data, bool send)
+      : _chan(chan), _send(send), _msg(BaseMsg::Simplex{data, &_signal}) {}
+
+  TypeMsgAwaiter(TypeChannel<T>* chan, T&& data)
+      : _chan(chan), _send(true), _value(std::move(data)), _msg(BaseMsg::Simplex{&*_value, &_signal}) {}
+
+  TypeMsgAwaiter(const TypeMsgAwaiter&) = delete;
+
+  TypeMsgAwaiter(TypeMsgAwaiter&&) = delete;
+
+  ~TypeMsgAwaiter() {
+    if (_submitted) {
+      _msg.drop();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> caller) {
+    _submitted = true;
+    if (_send) {
+      _chan->recv_from(&_msg);
+    } else {
+      _chan->send_to(&_msg);
+    }
+    return _signal.aquire().await_suspend(caller);
+  }
+
+  void await_resume() const noexcept {}
+
+ private:
+  TypeChannel<T>* _chan;
+  bool _send;
+  bool _submitted = false;
+  std::optional<T> _value;
+  Semaphore _signal = {0};
+  TypeMsg<T> _msg;
+};
+
 }  // namespace _impl
 
 /**
@@ -171,36 +220,14 @@ class Channel {
 
   Channel(size_t capacity = 0) : _chan(std::make_shared<_impl::TypeChannel<T>>(capacity)) {}
 
-  Coroutine<void> operator<<(T& x) {
-    Semaphore signal(0);
-    _impl::BaseMsg::Simplex simplex{&x, &signal};
-    _impl::TypeMsg<T> msg(simplex);
-    auto guard = defer([&msg]() { msg.drop(); });
-    _chan->recv_from(&msg);
-    co_await signal.aquire();
-  }
+  auto operator<<(T& x) -> _impl::TypeMsgAwaiter<T> { return _impl::TypeMsgAwaiter<T>(_chan.get(), &x, true); }
 
-  Coroutine<void> operator<<(T&& x) {
-    T data = std::move(x);
-    co_await (*this << ((T&)(data)));
-  }
+  auto operator<<(T&& x) -> _impl::TypeMsgAwaiter<T> { return _impl::TypeMsgAwaiter<T>(_chan.get(), std::move(x)); }
 
-  Coroutine<void> operator>>(T& x) {
-    Semaphore signal(0);
-    _impl::BaseMsg::Simplex simplex{&x, &signal};
-    _impl::TypeMsg<T> msg(simplex);
-    auto guard = defer([&msg]() { msg.drop(); });
-    _chan->send_to(&msg);
-    co_await signal.aquire();
-  }
+  auto operator>>(T& x) -> _impl::TypeMsgAwaiter<T> { return _impl::TypeMsgAwaiter<T>(_chan.get(), &x, false); }
 
-  Coroutine<void> operator>>(Dropout) {
-    Semaphore signal(0);
-    _impl::BaseMsg::Simplex simplex{nullptr, &signal};
-    _impl::TypeMsg<T> msg(simplex);
-    auto guard = defer([&msg]() { msg.drop(); });
-    _chan->send_to(&msg);
-    co_await signal.aquire();
+  auto operator>>(Dropout) -> _impl::TypeMsgAwaiter<T> {
+    return _impl::TypeMsgAwaiter<T>(_chan.get(), nullptr, false);
   }
 
   Nowait nowait() const { return Nowait(_chan.get()); }
@@ -277,6 +304,11 @@ class Select {
 
   struct Default {};
 
+  struct Timeout {
+    std::chrono::duration<double, std::milli> duration;
+    std::chrono::duration<double, std::milli> slack = {};  // see `TimedContext::create_timeout()`
+  };
+
   Select() = default;
 
   Select(const Select&) = delete;
@@ -298,15 +330,24 @@ class Select {
 
   void on(int key, Default);
 
+  /**
+   * @brief Activated if no other case is within the duration. Unlike a `cgo::timeout()` channel case, the timer is
+   *
+   *        cancelled as soon as the select completes
+   */
+  void on(int key, Timeout timeout);
+
   Coroutine<int> operator()();
 
  private:
   static const int InvalidSelectKey = INT_MIN;
 
-  _impl::Spinlock _mtx;
+  _impl::Spinlock _mtx{"select"};
   Semaphore _signal = {0};
   int _key = InvalidSelectKey;
   int _default_key = InvalidSelectKey;
+  int _timeout_key = InvalidSelectKey;
+  Timeout _timeout = {};
 
   std::vector<_impl::BaseMsg*> _msgs;
   std::vector<std::function<void()>> _listeners;
@@ -333,4 +374,24 @@ auto collect(Context& ctx, Coroutine<T> fn) -> Channel<V> {
   return chan;
 }
 
+/**
+ * @brief Spawn a coroutine awaiting `awaiter` (e.g. `cgo::sleep()`), send the result into returned channel
+ */
+template <typename A, typename T = decltype(std::declval<A&>().await_resume()),
+          typename V = std::conditional_t<std::is_void_v<T>, Nil, T>>
+  requires(!std::is_base_of_v<_impl::BaseFrame, A>)
+auto collect(Context& ctx, A awaiter) -> Channel<V> {
+  Channel<V> chan(0);
+  cgo::spawn(ctx, [](A awaiter, Channel<V> chan) -> cgo::Coroutine<void> {
+    if constexpr (std::is_void_v<T>) {
+      co_await awaiter;
+      co_await (chan << Nil{});
+    } else {
+      V res = co_await awaiter;
+      co_await (chan << std::move(res));
+    }
+  }(std::move(awaiter), chan));
+  return chan;
+}
+
 }  // namespace cgo
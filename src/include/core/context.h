@@ -6,13 +6,22 @@
 #include "core/event.h"
 #include "core/schedule.h"
 #include "core/timed.h"
+#include "core/uring.h"
 
 namespace cgo {
 
+struct ContextOptions {
+  TimerBackend timer_backend = TimerBackend::Heap;
+  std::chrono::nanoseconds timer_tick = std::chrono::milliseconds(1);  // only used by the timing wheel
+  bool precise_clock = false;  // read the clock on every `cgo::now()` instead of once per loop iteration
+  IoBackend io_backend = IoBackend::Epoll;
+};
+
 class Context {
   friend class _impl::SchedContext;
   friend class _impl::TimedContext;
   friend class _impl::EventContext;
+  friend class _impl::UringContext;
 
  public:
   Context() = default;
@@ -21,7 +30,7 @@ class Context {
 
   Context(Context&&) = delete;
 
-  void startup(size_t n_worker);
+  void startup(size_t n_worker, const ContextOptions& options = {});
 
   void shutdown();
 
@@ -30,10 +39,13 @@ class Context {
  private:
   std::vector<std::thread> _workers;
   std::unique_ptr<std::barrier<>> _barrier = nullptr;
-  std::unique_ptr<_impl::SchedContext> _sched_ctx = nullptr;
   std::unique_ptr<_impl::TimedContext> _timed_ctx = nullptr;
   std::unique_ptr<_impl::EventContext> _event_ctx = nullptr;
-  bool _finished = false;
+  std::unique_ptr<_impl::UringContext> _uring_ctx = nullptr;  // null if sockets use epoll
+  // destroyed first: frames left at shutdown may cancel timers or close sockets while they are destroyed
+  std::unique_ptr<_impl::SchedContext> _sched_ctx = nullptr;
+  std::atomic<bool> _finished = false;
+  ContextOptions _options;
 
   void _run(size_t pindex);
 };
@@ -4,6 +4,8 @@
 #include <exception>
 #include <functional>
 
+#include "core/memory.h"
+
 namespace cgo::_impl {
 
 template <typename T>
@@ -111,11 +113,33 @@ class BaseFrame {
     friend class FrameOperator;
 
    public:
+    static void* operator new(size_t n) { return FramePool::allocate(n); }
+
+    static void operator delete(void* ptr, size_t n) { FramePool::deallocate(ptr, n); }
+
     virtual ~BasePromise() = default;
 
     auto initial_suspend() noexcept -> std::suspend_always { return {}; }
 
+#ifdef CGO_SYMMETRIC_TRANSFER
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+
+      template <typename P>
+      auto await_suspend(std::coroutine_handle<P> h) noexcept -> std::coroutine_handle<> {
+        return h.promise()._call_stack_return();
+      }
+
+      void await_resume() noexcept {}
+    };
+
+    /**
+     * @brief Pop this frame from call stack and transfer to the awaiting parent directly
+     */
+    auto final_suspend() noexcept -> FinalAwaiter { return {}; }
+#else
     auto final_suspend() noexcept -> std::suspend_always { return {}; }
+#endif
 
     void unhandled_exception() noexcept { this->_error = std::current_exception(); }
 
@@ -127,6 +151,8 @@ class BaseFrame {
 
     auto _call_stack_pop() -> BasePromise*;
 
+    auto _call_stack_return() -> std::coroutine_handle<>;
+
    private:
     BasePromise* _entry = nullptr;
     BasePromise* _current = nullptr;
@@ -224,11 +250,23 @@ class Coroutine : public _impl::BaseFrame {
 
   bool await_ready() { return _handler.done(); }
 
+#ifdef CGO_SYMMETRIC_TRANSFER
+  /**
+   * @brief Push callee onto call stack and resume it directly, without bouncing through `FrameOperator`
+   */
+  auto await_suspend(std::coroutine_handle<> caller) -> std::coroutine_handle<> {
+    promise_type& p = std::coroutine_handle<promise_type>::from_address(caller.address()).promise();
+    _promise()._onwer = this;
+    p._call_stack_push(&_promise());
+    return _handler;
+  }
+#else
   void await_suspend(std::coroutine_handle<> caller) {
     promise_type& p = std::coroutine_handle<promise_type>::from_address(caller.address()).promise();
     _promise()._onwer = this;
     p._call_stack_push(&_promise());
   }
+#endif
 
   auto await_resume() {
     if (auto& ex = _promise()._error; ex) {
@@ -1,12 +1,31 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <expected>
 #include <functional>
+#include <new>
+#include <optional>
+#include <span>
+#include <vector>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 
 #include "core/schedule.h"
 
+#if defined(linux) || defined(__linux) || defined(__linux__)
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
 namespace cgo::_impl {
 
+class UringSocket;
+
 class Event {
  public:
   static constexpr size_t IN = 0x1;
@@ -38,10 +57,92 @@ class Event {
 
 class EventContext {
  public:
-  struct Task {
-    int fd;
-    Event on;
-    std::function<void(Event)> fn;
+  /**
+   * @brief Move-only `void(Event)` callable. Callables of up to `InlineSize` bytes, such as lambdas capturing a
+   *
+   *        shared pointer or a couple of references, are stored inline, so arming an fd does not allocate
+   */
+  class Callback {
+   public:
+    static constexpr size_t InlineSize = 48;
+
+    Callback() = default;
+
+    template <typename F>
+      requires(!std::is_same_v<std::decay_t<F>, Callback> && std::is_invocable_v<std::decay_t<F>&, Event>)
+    Callback(F&& fn) {
+      using T = std::decay_t<F>;
+      if constexpr (_fits_inline<T>()) {
+        new (_storage) T(std::forward<F>(fn));
+        _ops = &_inline_ops<T>;
+      } else {
+        new (_storage) T*(new T(std::forward<F>(fn)));
+        _ops = &_heap_ops<T>;
+      }
+    }
+
+    Callback(Callback&& rhs) noexcept { _take(rhs); }
+
+    Callback& operator=(Callback&& rhs) noexcept {
+      if (this != &rhs) {
+        reset();
+        _take(rhs);
+      }
+      return *this;
+    }
+
+    ~Callback() { reset(); }
+
+    void operator()(Event ev) { _ops->call(_storage, ev); }
+
+    explicit operator bool() const { return _ops; }
+
+    void reset() {
+      if (_ops) {
+        _ops->destroy(_storage);
+        _ops = nullptr;
+      }
+    }
+
+   private:
+    struct Ops {
+      void (*call)(void* storage, Event ev);
+      void (*move)(void* dst, void* src);  // also destroys the source
+      void (*destroy)(void* storage);
+    };
+
+    alignas(std::max_align_t) std::byte _storage[InlineSize];
+    const Ops* _ops = nullptr;
+
+    template <typename T>
+    static constexpr bool _fits_inline() {
+      return sizeof(T) <= InlineSize && alignof(T) <= alignof(std::max_align_t) &&
+             std::is_nothrow_move_constructible_v<T>;
+    }
+
+    template <typename T>
+    static constexpr Ops _inline_ops = {
+        [](void* storage, Event ev) { (*static_cast<T*>(storage))(ev); },
+        [](void* dst, void* src) {
+          new (dst) T(std::move(*static_cast<T*>(src)));
+          static_cast<T*>(src)->~T();
+        },
+        [](void* storage) { static_cast<T*>(storage)->~T(); },
+    };
+
+    template <typename T>
+    static constexpr Ops _heap_ops = {
+        [](void* storage, Event ev) { (**static_cast<T**>(storage))(ev); },
+        [](void* dst, void* src) { new (dst) T*(*static_cast<T**>(src)); },
+        [](void* storage) { delete *static_cast<T**>(storage); },
+    };
+
+    void _take(Callback& rhs) {
+      if (rhs._ops) {
+        rhs._ops->move(_storage, rhs._storage);
+        _ops = std::exchange(rhs._ops, nullptr);
+      }
+    }
   };
 
   class Handler {
@@ -50,36 +151,131 @@ class EventContext {
 
     ~Handler();
 
-    void add(int fd, Event ev, std::function<void(Event)>&& callback);
+    void add(int fd, Event ev, Callback&& callback);
 
-    void mod(int fd, Event ev, std::function<void(Event)>&& callback);
+    /**
+     * @brief Re-arm a registered fd. Readiness reported for the previous registration is dropped
+     */
+    void mod(int fd, Event ev, Callback&& callback);
 
     void del(int fd);
 
-    size_t handle(size_t handle_batch = 128, size_t timeout_ms = 50);
+    /**
+     * @brief Register `fd` once for edge-triggered readiness in both directions. Readiness nobody waits for is cached
+     *
+     *        on the fd until a waiter takes it, so waiting costs no `epoll_ctl()`
+     */
+    void watch(int fd);
+
+    /**
+     * @brief Wait for `dir`, `Event::IN` or `Event::OUT`, on a watched fd. A reader and a writer may wait at the same
+     *
+     *        time. Returns false and drops `callback` if readiness of `dir` is cached, which is consumed
+     */
+    bool wait(int fd, Event dir, Callback&& callback);
+
+    /**
+     * @brief Drop the waiter of `dir`, e.g. after a timeout. A callback taken by `handle()` already may still run
+     */
+    void unwait(int fd, Event dir);
+
+    /**
+     * @brief Run callbacks of ready fds, outside of the handler lock. Only one thread, the owning worker, handles
+     *
+     *        events of a handler. A negative timeout waits until some fd is ready
+     */
+    size_t handle(size_t handle_batch = 128, int timeout_ms = 50);
+
+    /**
+     * @brief Number of registered fds
+     */
+    size_t size() const { return _n_fds.load(); }
+
+    /**
+     * @brief The signal is emitted when an fd is added, so a worker parked on the futex starts polling
+     */
+    void on_handled(BaseLazySignal* signal) { _signal = signal; }
 
    private:
-    Spinlock _mtx;
-    std::unordered_map<int, Task> _tid_calls;
-    std::unordered_map<int, int> _fd_tids;
-    std::atomic<int> _gid = 0;
+    /**
+     * @brief Registration of one fd. The generation is part of the epoll data, and bumped on every `mod()` and
+     *
+     *        `del()`, so an event of an earlier registration is told apart from the current one
+     */
+    struct Slot {
+      Event on;
+      uint32_t generation = 0;
+      bool registered = false;
+      bool watched = false;
+      size_t ready = 0;  // cached readiness of a watched fd
+      Callback fn;
+      std::array<Callback, 2> waiters;  // of a watched fd, for `Event::IN` and `Event::OUT`
+    };
+
+    static size_t _direction(Event dir) { return (dir & Event::IN) ? 0 : 1; }
+
+    /**
+     * @brief Callback taken from a slot by `handle()`, to run after the lock is released
+     */
+    struct Pending {
+      int fd;
+      uint32_t generation;
+      bool persistent;
+      Event ev;
+      Callback fn;
+    };
+
+    void _wake(Slot& slot, size_t events);
+
+    /**
+     * @brief Slot of a registered fd, or null
+     */
+    auto _find(int fd) -> Slot*;
+
+    /**
+     * @brief Slot of `fd`, created if missing. Fds of this handler, `fd % _n_partition == _pindex`, are dense in
+     *
+     *        `_slots` at `fd / _n_partition`. The few registered elsewhere, the own fds of a worker, are strays
+     */
+    auto _slot(int fd) -> Slot&;
+
+    friend class EventContext;
+
+    Spinlock _mtx{"event"};
+    size_t _pindex = 0;
+    size_t _n_partition = 1;
+    std::vector<Slot> _slots;  // indexed by fd / _n_partition
+    std::unordered_map<int, Slot> _strays;
+#if defined(linux) || defined(__linux) || defined(__linux__)
+    std::vector<::epoll_event> _ev_buffer;  // reused by every `handle()`
+#endif
+    std::vector<Pending> _pending;
+    std::atomic<size_t> _n_fds = 0;
+    BaseLazySignal* _signal = nullptr;
     int _fd = 0;
   };
 
   static auto at(Context& ctx) -> EventContext&;
 
-  EventContext(size_t n_partition) : _handlers(n_partition) {}
-
-  void add(int fd, Event ev, std::function<void(Event)>&& callback) {
-    handler(fd).add(fd, ev, std::forward<std::function<void(Event)>>(callback));
+  EventContext(size_t n_partition) : _handlers(n_partition) {
+    for (size_t i = 0; i < n_partition; ++i) {
+      _handlers[i]._pindex = i;
+      _handlers[i]._n_partition = n_partition;
+    }
   }
 
-  void mod(int fd, Event ev, std::function<void(Event)>&& callback) {
-    handler(fd).mod(fd, ev, std::forward<std::function<void(Event)>>(callback));
-  }
+  void add(int fd, Event ev, Callback&& callback) { handler(fd).add(fd, ev, std::move(callback)); }
+
+  void mod(int fd, Event ev, Callback&& callback) { handler(fd).mod(fd, ev, std::move(callback)); }
 
   void del(int fd) { handler(fd).del(fd); }
 
+  void watch(int fd) { handler(fd).watch(fd); }
+
+  bool wait(int fd, Event dir, Callback&& callback) { return handler(fd).wait(fd, dir, std::move(callback)); }
+
+  void unwait(int fd, Event dir) { handler(fd).unwait(fd, dir); }
+
   size_t run_handler(size_t pindex, size_t batch_size, std::chrono::duration<double, std::milli> timeout) {
     return handler(pindex).handle(batch_size, timeout.count());
   }
@@ -92,20 +288,24 @@ class EventContext {
 
 class EventLazySignal : public BaseLazySignal {
  public:
-  EventLazySignal(Context& ctx, size_t pindex, bool nowait = false);
+  EventLazySignal(Context& ctx, size_t pindex);
 
   void close();
 
  private:
+  static constexpr size_t OwnFds = 2;
+
   Context* _ctx;
   size_t _pindex;
-  bool _nowait;
   int _fd;
-  int _sig_data = 0;
+  int _timer_fd;  // armed to the deadline of the next timer while polling
+  uint64_t _sig_data = 1;
 
-  void _emit() override;
+  bool _pollable() override;
 
-  void _wait(std::unique_lock<Spinlock>& guard, std::chrono::duration<double, std::milli> timeout) override;
+  void _poll(std::chrono::duration<double, std::milli> duration) override;
+
+  void _interrupt() override;
 
   void _callback(Event ev);
 };
@@ -114,6 +314,94 @@ class EventLazySignal : public BaseLazySignal {
 
 namespace cgo {
 
+#if defined(linux) || defined(__linux) || defined(__linux__)
+
+/**
+ * @brief Address of a datagram peer as the kernel reports it, nothing is formatted until asked
+ */
+struct Endpoint {
+  union {
+    ::sockaddr_in v4;
+    ::sockaddr_in6 v6;
+  } addr = {};
+  ::socklen_t size = 0;
+
+  static auto from(const std::string& ip, uint16_t port) -> std::optional<Endpoint>;
+
+  std::string ip() const;
+
+  uint16_t port() const;
+};
+
+/**
+ * @brief Datagrams with their peers, in an arena allocated once and reused by every `Socket::recv_batch()` and
+ *
+ *        `Socket::send_batch()`. With segmentation offload an entry holds a run of equal sized datagrams, sent as
+ *
+ *        one buffer split by the kernel (`UDP_SEGMENT`), or received coalesced (`UDP_GRO`)
+ */
+class DatagramBatch {
+ public:
+  /**
+   * @param datagram_size Longer entries are received truncated, 64KB to receive coalesced datagrams whole
+   */
+  DatagramBatch(size_t capacity, size_t datagram_size = 2048);
+
+  DatagramBatch(const DatagramBatch&) = delete;
+
+  size_t capacity() const { return _headers.size(); }
+
+  size_t size() const { return _size; }
+
+  auto data(size_t i) const -> std::span<const std::byte> {
+    return {static_cast<const std::byte*>(_iovs[i].iov_base), _iovs[i].iov_len};
+  }
+
+  auto peer(size_t i) const -> const Endpoint& { return _peers[i]; }
+
+  /**
+   * @brief Length of the datagrams coalesced in entry `i`, the last one may be shorter. 0 if it is one datagram
+   */
+  size_t segment_size(size_t i) const { return _segments[i]; }
+
+  /**
+   * @brief Copy a datagram to send into the arena. With `segment_size`, `data` is sent as datagrams of that length,
+   *
+   *        the last one may be shorter, at most 64 of them and 64KB in all
+   *
+   * @return False if the batch is full or `data` is longer than an entry
+   */
+  bool push(std::span<const std::byte> data, const Endpoint& peer, uint16_t segment_size = 0);
+
+  void clear() { _size = 0; }
+
+ private:
+  friend class Socket;
+
+  size_t _datagram_size;
+  size_t _size = 0;
+  std::vector<std::byte> _arena;
+  std::vector<Endpoint> _peers;
+  std::vector<::iovec> _iovs;
+  std::vector<::mmsghdr> _headers;
+  std::vector<uint16_t> _segments;
+
+  union Control {
+    ::cmsghdr header;
+    char buf[CMSG_SPACE(sizeof(int))];
+  };
+  std::vector<Control> _controls;  // carrying the segment size
+
+  /**
+   * @brief Point the headers of the first `n` datagrams at their buffers and peers, as `sendmmsg()` and `recvmmsg()`
+   *
+   *        take them
+   */
+  void _prepare(size_t n, bool recv);
+};
+
+#endif
+
 /**
  * @brief Only support IPV4 now
  *
@@ -153,6 +441,13 @@ class Socket {
 
   std::expected<void, Error> listen(size_t backlog = 1024);
 
+#if defined(linux) || defined(__linux) || defined(__linux__)
+  /**
+   * @brief Let a UDP socket receive datagrams of a flow coalesced (`UDP_GRO`), see `DatagramBatch::segment_size()`
+   */
+  std::expected<void, Error> set_gro(bool enable);
+#endif
+
   Coroutine<std::expected<Socket, Error>> accept();
 
   /**
@@ -167,10 +462,102 @@ class Socket {
   Coroutine<std::expected<std::string, Error>> recv(
       size_t size, std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
 
+  /**
+   * @brief Receive into a buffer owned by the caller, e.g. one reused for every read of a connection
+   *
+   * @return Number of bytes received, 0 at once for an empty buffer
+   */
+  Coroutine<std::expected<size_t, Error>> recv_into(
+      std::span<std::byte> buffer,
+      std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
+
+  /**
+   * @brief Send all of `data`, which must stay valid until the returned coroutine is done
+   */
   Coroutine<std::expected<void, Error>> send(
-      const std::string& data,
+      std::span<const std::byte> data,
       std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
 
+  Coroutine<std::expected<void, Error>> send(
+      std::string_view data,
+      std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1)) {
+    return send(std::as_bytes(std::span(data)), timeout);
+  }
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+  /**
+   * @brief Send all of `data` with `MSG_ZEROCOPY`, so the kernel sends from the pages of `data` rather than copying.
+   *
+   *        Done once the kernel notifies it no longer references `data`, which may be freed or reused then. Pays off
+   *
+   *        for large payloads only, and one zero-copy send at a time per socket. On error, `data` may still be
+   *
+   *        referenced until the socket is closed
+   */
+  Coroutine<std::expected<void, Error>> send_zerocopy(
+      std::span<const std::byte> data,
+      std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
+
+  /**
+   * @brief Send `length` bytes of the file `file_fd` from `offset` with `sendfile()`, not copied through user space
+   */
+  Coroutine<std::expected<void, Error>> send_file(
+      int file_fd, off_t offset, size_t length,
+      std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
+
+  /**
+   * @brief Move everything received on this socket to `to` through a pipe with `splice()`, not copied through user
+   *
+   *        space, until the end of the stream. A proxy relays each direction in a coroutine of its own. `to` is not
+   *
+   *        shut down at the end
+   *
+   * @return Number of bytes relayed
+   */
+  Coroutine<std::expected<size_t, Error>> relay(
+      Socket& to, std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
+
+  /**
+   * @brief Receive into the buffers of `parts` in order, by one syscall
+   *
+   * @return Number of bytes received, 0 at once if every buffer is empty
+   */
+  Coroutine<std::expected<size_t, Error>> readv(
+      std::span<const ::iovec> parts,
+      std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
+
+  /**
+   * @brief Send all buffers of `parts` in order, e.g. a header, a cached body and a trailer, without joining them.
+   *
+   *        The buffers must stay valid until the returned coroutine is done
+   */
+  Coroutine<std::expected<void, Error>> writev(
+      std::span<const ::iovec> parts,
+      std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
+#endif
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+  /**
+   * @brief Receive up to `batch.capacity()` datagrams by one `recvmmsg()`, replacing those in `batch`. Waits for the
+   *
+   *        first datagram only
+   *
+   * @return Number of datagrams received
+   */
+  Coroutine<std::expected<size_t, Error>> recv_batch(
+      DatagramBatch& batch,
+      std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
+
+  /**
+   * @brief Send the datagrams of `batch` to their peers with as few `sendmmsg()` as the socket buffer allows. A
+   *
+   *        received batch sent as is echoes every datagram to its sender
+   */
+  Coroutine<std::expected<void, Error>> send_batch(
+      DatagramBatch& batch,
+      std::chrono::duration<double, std::milli> timeout = std::chrono::duration<double, std::milli>(-1));
+#endif
+
   Coroutine<std::expected<size_t, Error>> sendto(const std::string& data, const std::string& ip, uint16_t port,
                                                  std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
 
@@ -179,6 +566,13 @@ class Socket {
 
   void close();
 
+  /**
+   * @brief Let the timeouts of this socket fire up to `slack` late, so timeouts of many sockets are rounded to
+   *
+   *        shared deadlines and expire in one batch. Useful for idle-connection timeouts, accepted sockets inherit it
+   */
+  void set_timeout_slack(std::chrono::duration<double, std::milli> slack) { _timeout_slack = slack; }
+
   int fd() const { return _fd; }
 
   operator int() const { return _fd; }
@@ -190,6 +584,8 @@ class Socket {
   int _fd = -1;
   Protocol _protocol;
   AddressFamily _family;
+  std::chrono::duration<double, std::milli> _timeout_slack = {};
+  std::shared_ptr<_impl::UringSocket> _uring = nullptr;  // of a TCP socket if the context uses io_uring
 
   Socket(Context& ctx, Protocol protocol, AddressFamily family);
 
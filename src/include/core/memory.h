@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cgo::_impl {
+
+/**
+ * @brief Size-class slab allocator for coroutine frames.
+ *
+ *        Every thread owns a pool of free lists. A frame freed by its owner thread goes back to the local free list,
+ *
+ *        a frame freed by another thread is pushed onto the owner's lock-free return list, which is drained by the
+ *
+ *        owner on its next allocation. Pools are adopted by new threads after their owner exits.
+ */
+class FramePool {
+ public:
+  static constexpr size_t BlockAlign = 64;
+  static constexpr size_t ClassNum = 32;  // blocks up to 2KB, larger frames go to global operator new
+  static constexpr size_t SlabSize = 64 * 1024;
+
+  struct Stats {
+    size_t block_size = 0;
+    size_t live_frames = 0;
+    size_t live_bytes = 0;
+    size_t cached_frames = 0;
+  };
+
+  static void* allocate(size_t n);
+
+  static void deallocate(void* ptr, size_t n);
+
+  /**
+   * @brief Aggregate counters of all pools, one entry per size class
+   */
+  static auto stats() -> std::array<Stats, ClassNum>;
+
+  FramePool() = default;
+
+  FramePool(const FramePool&) = delete;
+
+  FramePool(FramePool&&) = delete;
+
+ private:
+  struct Header {
+    FramePool* owner;
+    size_t size_class;
+  };
+
+  struct Block {
+    Block* next;
+  };
+
+  class Holder;
+
+  std::array<Block*, ClassNum> _free = {};
+  std::array<std::atomic<Block*>, ClassNum> _remote = {};
+  std::array<std::atomic<size_t>, ClassNum> _live = {};
+  std::array<std::atomic<size_t>, ClassNum> _bytes = {};
+  std::array<std::atomic<size_t>, ClassNum> _cached = {};
+  std::vector<void*> _slabs;
+  bool _adopted = false;
+
+  inline static thread_local FramePool* _local = nullptr;
+
+  static constexpr size_t _block_size(size_t size_class) { return (size_class + 1) * BlockAlign; }
+
+  static constexpr size_t _size_class(size_t n) { return (n + sizeof(Header) - 1) / BlockAlign; }
+
+  static auto _this_pool() -> FramePool*;
+
+  auto _pop(size_t size_class) -> Block*;
+
+  void _refill(size_t size_class);
+
+  void _push_remote(size_t size_class, Block* block);
+};
+
+}  // namespace cgo::_impl
@@ -2,26 +2,24 @@
 
 #include <any>
 #include <atomic>
-#include <condition_variable>
-#include <list>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <unordered_map>
 #include <vector>
 
 #include "core/coroutine.h"
+#include "core/spinlock.h"
 
 namespace cgo::_impl {
 
-class Spinlock {
- public:
-  void lock();
-
-  void unlock() { _locked = false; }
-
- private:
-  std::atomic<bool> _locked = false;
-};
-
+/**
+ * @brief Parking spot of a worker. `emit()` wakes the worker sleeping in `wait()`, or makes its next `wait()` return
+ *
+ *        at once, so a wakeup sent between checking for work and going to sleep is never lost. The worker sleeps on a
+ *
+ *        futex, or in the event poller when it has I/O to wait for
+ */
 class BaseLazySignal {
  public:
   void emit();
@@ -29,16 +27,26 @@ class BaseLazySignal {
   void wait(std::chrono::duration<double, std::milli> duration);
 
  protected:
-  Spinlock _mtx;
-  std::condition_variable_any _cond;
-  bool _emitted = false;
-  bool _waited = false;
+  static constexpr uint32_t Idle = 0;
+  static constexpr uint32_t Parked = 1;
+  static constexpr uint32_t Polling = 2;
+  static constexpr uint32_t Emitted = 3;
+
+  std::atomic<uint32_t> _state = Idle;
+
+  virtual bool _pollable() { return false; }
 
-  virtual void _emit() { _cond.notify_one(); }
+  virtual void _poll(std::chrono::duration<double, std::milli>) {}
 
-  virtual void _wait(std::unique_lock<Spinlock>& guard, std::chrono::duration<double, std::milli> duration) {
-    _cond.wait_for(guard, duration);
-  }
+  /**
+   * @brief Interrupt `_poll()`
+   */
+  virtual void _interrupt() {}
+
+ private:
+  void _park(std::chrono::duration<double, std::milli> duration);
+
+  void _unpark();
 };
 
 class SchedContext {
@@ -53,19 +61,43 @@ class SchedContext {
 
   static auto& this_coroutine_locals() { return SchedContext::_running_task->locals; }
 
-  SchedContext(Context& ctx, size_t n_partition)
-      : _ctx(&ctx), _task_allocators(n_partition), _task_schedulers(n_partition) {}
+  SchedContext(Context& ctx, size_t n_partition);
 
   ~SchedContext();
 
   void final_schedule(size_t pindex);
 
+  /**
+   * @brief Schedule on current worker if called inside this context, otherwise on any worker
+   */
   void create_scheduled(Coroutine<void>&& fn);
 
-  void on_scheduled(size_t pindex, BaseLazySignal& signal) { _scheduler(pindex)._signal = &signal; }
+  /**
+   * @brief Schedule on the given worker
+   */
+  void create_scheduled(size_t pindex, Coroutine<void>&& fn);
+
+  void on_scheduled(size_t pindex, BaseLazySignal& signal);
 
   size_t run_scheduled(size_t pindex, size_t batch_size);
 
+  /**
+   * @brief Register the worker as parked before it sleeps on its signal. Returns false if runnable tasks show up in
+   *
+   *        the meantime, in which case the worker must not sleep
+   */
+  bool park_scheduled(size_t pindex);
+
+  /**
+   * @brief Called by the worker after its signal wakes it
+   */
+  void unpark_scheduled(size_t pindex);
+
+  /**
+   * @brief Wake every worker, e.g. to let them see the context is closed
+   */
+  void unpark_all();
+
  private:
   class Condition;
 
@@ -84,8 +116,8 @@ class SchedContext {
     Coroutine<void> fn;
 
     bool yielded = false;
+    bool notified = false;
     Condition* waiting_cond = nullptr;
-    Spinlock* waiting_mtx = nullptr;
 
     std::vector<std::any> locals;
     size_t execute_cnt = 0;
@@ -95,9 +127,14 @@ class SchedContext {
     Task(Context* ctx, size_t id, Coroutine<void>&& fn) : BaseTask(ctx, id), fn(std::move(fn)) {}
   };
 
+  /**
+   * @brief Slab of fixed-size task slots, reused through a free list and only released with the allocator
+   */
   class Allocator {
     friend class SchedContext;
 
+    struct Slot;
+
    public:
     class Handler {
      public:
@@ -125,73 +162,232 @@ class SchedContext {
       Task* _task = nullptr;
     };
 
-    auto create(Context* ctx, size_t id, Coroutine<void>&& fn) -> Handler;
+    Allocator() = default;
+
+    Allocator(const Allocator&) = delete;
+
+    ~Allocator();
+
+    /**
+     * @brief Task ids are generated per allocator as `seq * n_partition + pindex`
+     */
+    auto create(Context* ctx, Coroutine<void>&& fn) -> Handler;
 
     void destroy(Handler);
 
+    /**
+     * @brief Snapshot of occupied slots
+     */
+    auto live_tasks() -> std::vector<Task*>;
+
    private:
-    Spinlock _mtx;
-    std::list<Task> _pool;
-    std::unordered_map<size_t, std::list<Task>::iterator> _index;
+    static constexpr size_t ChunkSize = 256;
+
+    struct Slot {
+      alignas(Task) std::byte storage[sizeof(Task)];  // keep first, so a task pointer is also its slot pointer
+      size_t live_pos = 0;
+      Slot* next_free = nullptr;
+
+      static auto of(Task* task) -> Slot* { return reinterpret_cast<Slot*>(task); }
+
+      auto task() -> Task* { return std::launder(reinterpret_cast<Task*>(storage)); }
+    };
+
+    Spinlock _mtx{"allocator"};
+    size_t _pindex = 0;
+    size_t _n_partition = 1;
+    size_t _seq = 0;
+    std::vector<std::unique_ptr<Slot[]>> _chunks;
+    std::vector<Slot*> _live;
+    Slot* _free = nullptr;
   };
 
+  /**
+   * @brief Chase-Lev work-stealing deque of a worker. Only the owner pushes at the bottom. Tasks are taken from the top
+   *
+   *        by both the owner and thieves, so the owner runs its tasks in FIFO order and a yielded task goes behind
+   */
   class Scheduler {
     friend class SchedContext;
 
    public:
-    Scheduler() { _runnable_head.link_back(&_runnable_tail); }
+    Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+
+    void push(Allocator::Handler task);
+
+    auto pop() -> Allocator::Handler;
+
+    /**
+     * @brief Move half of the tasks into `dst`, which must be owned by the calling worker
+     */
+    size_t steal_half(Scheduler& dst);
+
+    size_t size() const;
+
+   private:
+    struct Buffer {
+      size_t mask;
+      std::unique_ptr<std::atomic<Task*>[]> slots;
+
+      Buffer(size_t capacity) : mask(capacity - 1), slots(new std::atomic<Task*>[capacity]) {}
+    };
+
+    alignas(64) std::atomic<int64_t> _top = 0;
+    alignas(64) std::atomic<int64_t> _bottom = 0;
+    std::atomic<Buffer*> _buffer;
+    std::vector<std::unique_ptr<Buffer>> _buffers;  // retired buffers may still be read by thieves
+    BaseLazySignal* _signal = nullptr;
+    Task* _runnext = nullptr;  // owner only, not stealable
+    size_t _runnext_cnt = 0;
+    bool _searching = false;  // only changed by others under `_idle_mtx` while the worker is parked
+    bool _parked = false;     // guarded by `_idle_mtx` of the context
+
+    auto _grow(Buffer* buffer, int64_t top, int64_t bottom) -> Buffer*;
+  };
+
+  /**
+   * @brief Locked FIFO for tasks scheduled from threads which are not the owner worker. Used as the global queue of
+   *
+   *        a context and as the mailbox of each worker
+   */
+  class Injector {
+    friend class SchedContext;
+
+   public:
+    Injector() { _runnable_head.link_back(&_runnable_tail); }
 
     void push(Allocator::Handler task);
 
     auto pop() -> Allocator::Handler;
 
+    bool empty() const { return _size.load(std::memory_order_relaxed) == 0; }
+
    private:
-    Spinlock _mtx;
+    Spinlock _mtx{"injector"};
     BaseTask _runnable_head;
     BaseTask _runnable_tail;
-    BaseLazySignal* _signal = nullptr;
+    std::atomic<size_t> _size = 0;
   };
 
+  /**
+   * @brief A counting wait queue. `notify()` adds a signal and wakes the first blocked task, which takes the signal
+   *
+   *        before its frame is resumed, or blocks again if the signal is taken by others in the meantime
+   */
   class Condition {
     friend class SchedContext;
 
    public:
-    Condition() { _blocked_head.link_back(&_blocked_tail); }
+    class Awaiter {
+     public:
+      Awaiter(Condition* cond) : _cond(cond) {}
 
-    Coroutine<void> wait(std::unique_lock<Spinlock>& guard);
+      bool await_ready() const noexcept { return false; }
+
+      bool await_suspend(std::coroutine_handle<>) { return _cond->_suspend(); }
+
+      void await_resume() const noexcept {}
+
+     private:
+      Condition* _cond;
+    };
+
+    Condition(size_t signals = 0) : _signals(signals) { _blocked_head.link_back(&_blocked_tail); }
+
+    auto wait() -> Awaiter { return Awaiter(this); }
 
     void notify();
 
+    size_t signals() const { return _signals; }
+
    private:
-    Spinlock _mtx;
+    Spinlock _mtx{"condition"};
     BaseTask _blocked_head;
     BaseTask _blocked_tail;
-    Context* _scheduled_ctx = nullptr;
+    size_t _signals;
+
+    bool _suspend();
 
-    void _schedule_from_this();
+    bool _resume(Allocator::Handler& task);
 
-    void _suspend_to_this(Allocator::Handler task, Spinlock* waiting_mtx);
+    auto _schedule_from_this() -> Task*;
+
+    void _suspend_to_this(Allocator::Handler task);
 
     void _remove(Task* task);
   };
 
   struct Yielder {
    public:
-    auto operator()() const -> std::suspend_always {
-      return (SchedContext::_running_task->yielded = true, std::suspend_always{});
-    }
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<>) const noexcept { SchedContext::_running_task->yielded = true; }
+
+    void await_resume() const noexcept {}
   };
 
+  static constexpr size_t InjectInterval = 61;
+  static constexpr size_t RunnextLimit = 16;
+
   Context* _ctx;
-  std::atomic<size_t> _tid = 0;
+  std::atomic<size_t> _cursor = 0;  // round robin over workers for outside spawns, signals and steal victims
   std::vector<Allocator> _task_allocators;
   std::vector<Scheduler> _task_schedulers;
+  std::vector<Injector> _task_mailboxes;
+  Injector _injector;
+  Spinlock _idle_mtx{"idle"};
+  std::vector<size_t> _parked;  // stack of parked workers
+  std::atomic<size_t> _n_parked = 0;
+  std::atomic<size_t> _n_searching = 0;
   inline static thread_local Allocator::Handler _running_task = nullptr;
+  inline static thread_local SchedContext* _worker_ctx = nullptr;
+  inline static thread_local size_t _worker_pindex = 0;
 
   auto _allocator(size_t id) -> Allocator& { return _task_allocators[id % _task_allocators.size()]; }
 
   auto _scheduler(size_t id) -> Scheduler& { return _task_schedulers[id % _task_schedulers.size()]; }
 
+  auto _mailbox(size_t id) -> Injector& { return _task_mailboxes[id % _task_mailboxes.size()]; }
+
+  void _signal(size_t pindex);
+
+  /**
+   * @brief Wake one parked worker for newly runnable tasks, unless some worker is already searching for tasks. The
+   *
+   *        woken worker starts as a searching one, so a burst of spawns wakes workers one after another instead of all
+   *
+   *        at once
+   */
+  void _notify_parked();
+
+  /**
+   * @brief At most half of the workers search at the same time
+   */
+  bool _transition_to_searching(size_t pindex);
+
+  /**
+   * @brief Returns true if the worker was the last searching one
+   */
+  bool _transition_from_searching(size_t pindex);
+
+  bool _has_runnable(size_t pindex);
+
+  /**
+   * @brief Push to the deque of current worker, or to the injector if called outside of this context
+   */
+  void _schedule(Allocator::Handler task);
+
+  /**
+   * @brief Schedule a task unblocked by the running task into the runnext slot of current worker, so it runs right
+   *
+   *        after the running task. The previous runnext task is kicked to the deque
+   */
+  void _wake(Allocator::Handler task);
+
+  auto _steal(size_t pindex) -> Allocator::Handler;
+
   void _execute(Allocator::Handler task);
 };
 
@@ -199,7 +395,10 @@ struct SchedController {
  public:
   struct Yielder : public SchedContext::Yielder {};
 
-  class Condition : public SchedContext::Condition {};
+  class Condition : public SchedContext::Condition {
+   public:
+    using SchedContext::Condition::Condition;
+  };
 };
 
 }  // namespace cgo::_impl
@@ -208,29 +407,32 @@ namespace cgo {
 
 class Semaphore {
  public:
-  Semaphore(size_t vacant) : _vacant(vacant) {}
+  using Awaiter = _impl::SchedController::Condition::Awaiter;
+
+  Semaphore(size_t vacant) : _cond(vacant) {}
 
   Semaphore(const Semaphore&) = delete;
 
   Semaphore(Semaphore&&) = delete;
 
-  Coroutine<void> aquire();
+  /**
+   * @brief Wait until a vacancy is released. The awaiter needs no coroutine frame
+   */
+  auto aquire() -> Awaiter { return _cond.wait(); }
 
-  void release();
+  void release() { _cond.notify(); }
 
-  size_t count() { return _vacant; }
+  size_t count() { return _cond.signals(); }
 
  private:
-  _impl::Spinlock _mtx;
   _impl::SchedController::Condition _cond;
-  size_t _vacant;
 };
 
 class Mutex {
  public:
   Mutex() : _sem(1) {}
 
-  Coroutine<void> lock() { return _sem.aquire(); }
+  auto lock() -> Semaphore::Awaiter { return _sem.aquire(); }
 
   void unlock() { _sem.release(); }
 
@@ -258,7 +460,7 @@ class DeferGuard {
   return DeferGuard(std::forward<std::function<void()>>(fn));
 }
 
-inline Coroutine<void> yield() { co_await _impl::SchedController::Yielder{}(); }
+inline auto yield() -> _impl::SchedController::Yielder { return {}; }
 
 inline size_t this_coroutine_id() { return _impl::SchedContext::this_coroutine_id(); }
 
@@ -266,6 +468,18 @@ inline auto this_coroutine_ctx() -> Context& { return _impl::SchedContext::this_
 
 inline auto this_coroutine_locals() -> std::vector<std::any>& { return _impl::SchedContext::this_coroutine_locals(); }
 
+/**
+ * @brief Spawn on current worker if called inside `ctx`, so the child shares the cache of its parent. Spawned tasks
+ *
+ *        are balanced by stealing
+ */
 inline void spawn(Context& ctx, Coroutine<void>&& fn) { _impl::SchedContext::at(ctx).create_scheduled(std::move(fn)); }
 
+/**
+ * @brief Spawn on the `pindex`-th worker of `ctx`
+ */
+inline void spawn_on(Context& ctx, size_t pindex, Coroutine<void>&& fn) {
+  _impl::SchedContext::at(ctx).create_scheduled(pindex, std::move(fn));
+}
+
 }  // namespace cgo
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "core/config.h"
+
+namespace cgo::_impl {
+
+/**
+ * @brief Adaptive lock for short critical sections. Waiters spin on a plain load with `pause` and exponential backoff,
+ *
+ *        then park on a futex. The spin budget follows how long recent acquisitions spun, and shrinks when spinning
+ *
+ *        ends up parking anyway, so an oversubscribed worker gives up its core instead of burning it.
+ *
+ *        With `CGO_LOCK_STATS` defined in the generated `core/config.h`, by `-DLOCK_STATS=ON`, every lock counts
+ *
+ *        acquisitions, spins and parks under its name.
+ */
+class Spinlock {
+ public:
+  struct Stats {
+    const char* name = nullptr;
+    const void* lock = nullptr;  // nullptr for the totals of destroyed locks
+    size_t acquisitions = 0;
+    size_t spins = 0;
+    size_t parks = 0;
+  };
+
+#if defined(CGO_LOCK_STATS)
+  static constexpr bool StatsEnabled = true;
+#else
+  static constexpr bool StatsEnabled = false;
+#endif
+
+  explicit Spinlock(const char* name = "spinlock");
+
+  Spinlock(const Spinlock&) = delete;
+
+  Spinlock(Spinlock&&) = delete;
+
+  ~Spinlock();
+
+  void lock() {
+    uint32_t expected = Unlocked;
+    if (!_state.compare_exchange_strong(expected, Locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+      _lock_slow();
+    }
+#if defined(CGO_LOCK_STATS)
+    _acquisitions.store(_acquisitions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#endif
+  }
+
+  bool try_lock() {
+    uint32_t expected = Unlocked;
+    bool locked = _state.compare_exchange_strong(expected, Locked, std::memory_order_acquire, std::memory_order_relaxed);
+#if defined(CGO_LOCK_STATS)
+    if (locked) {
+      _acquisitions.store(_acquisitions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+#endif
+    return locked;
+  }
+
+  void unlock() {
+    if (_state.exchange(Unlocked, std::memory_order_release) == Contended) {
+      _unpark();
+    }
+  }
+
+  /**
+   * @brief Counters of live locks, followed by the totals of destroyed locks per name. Empty without `CGO_LOCK_STATS`
+   */
+  static auto stats() -> std::vector<Stats>;
+
+  /**
+   * @brief Print counters merged by name, and the most contended live locks
+   */
+  static void dump_stats(std::FILE* out = stderr);
+
+ private:
+  static constexpr uint32_t Unlocked = 0;
+  static constexpr uint32_t Locked = 1;
+  static constexpr uint32_t Contended = 2;  // locked, and some waiter may be parked
+
+  static constexpr uint32_t MinSpins = 64;
+  static constexpr uint32_t MaxSpins = 2048;
+  static constexpr uint32_t MaxBackoff = 64;
+
+  std::atomic<uint32_t> _state = Unlocked;
+  std::atomic<uint32_t> _spin_hint = 0;  // moving average of spins taken by recent slow acquisitions
+
+#if defined(CGO_LOCK_STATS)
+  const char* _name;
+  std::atomic<size_t> _acquisitions = 0;
+  std::atomic<size_t> _spins = 0;
+  std::atomic<size_t> _parks = 0;
+#endif
+
+  void _lock_slow();
+
+  void _park();
+
+  void _unpark();
+};
+
+}  // namespace cgo::_impl
@@ -1,69 +1,366 @@
 #pragma once
 
+#include <array>
 #include <atomic>
-#include <optional>
+#include <memory>
 #include <vector>
 
 #include "core/channel.h"
 #include "core/schedule.h"
 
+namespace cgo {
+
+/**
+ * @brief Where a context keeps its timers
+ */
+enum class TimerBackend {
+  Heap,   // binary heap, O(log n) insert and cancel, exact deadlines
+  Wheel,  // hierarchical timing wheel, O(1) insert and cancel, deadlines are rounded up to the tick
+};
+
+}  // namespace cgo
+
 namespace cgo::_impl {
 
+/**
+ * @brief Time of the current event-loop iteration. A worker refreshes it once per iteration, so timers created and
+ *
+ *        expired in one iteration share a single clock read. Deadlines computed from it may be early by the time the
+ *
+ *        current batch of tasks has run so far. Other threads, and workers of a context with `precise_clock`, read
+ *
+ *        the clock on every call
+ */
+class LoopClock {
+ public:
+  using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+  static auto now() -> TimePoint { return _cached ? _now : std::chrono::steady_clock::now(); }
+
+  static auto update() -> TimePoint {
+    _now = std::chrono::steady_clock::now();
+    return _now;
+  }
+
+  /**
+   * @brief Serve `now()` from the cache on the calling thread until `detach()`
+   */
+  static void attach() {
+    _cached = true;
+    update();
+  }
+
+  static void detach() { _cached = false; }
+
+ private:
+  inline static thread_local bool _cached = false;
+  inline static thread_local TimePoint _now = {};
+};
+
 class TimedContext {
+  class Scheduler;
+  struct Timer;
+
  public:
   using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
   using Callback = std::function<void()>;
 
+  /**
+   * @brief Reference to a timer created by `create_timeout()`. Must not be used after the context is destroyed
+   */
+  class Handle {
+    friend class TimedContext;
+
+   public:
+    Handle() = default;
+
+    /**
+     * @brief Remove the timer if it has not fired yet. If its callback is running on another thread, wait for the
+     *
+     *        callback to finish, so nothing it references is used after `cancel()` returns
+     *
+     * @return false if the timer has already fired or been cancelled
+     */
+    bool cancel();
+
+    explicit operator bool() const { return _timer; }
+
+   private:
+    Scheduler* _scheduler = nullptr;
+    Timer* _timer = nullptr;
+    uint32_t _generation = 0;
+
+    Handle(Scheduler* scheduler, Timer* timer, uint32_t generation)
+        : _scheduler(scheduler), _timer(timer), _generation(generation) {}
+  };
+
   static auto at(Context& ctx) -> TimedContext&;
 
-  TimedContext(size_t n_partition) : _schedulers(n_partition) {}
+  TimedContext(size_t n_partition, TimerBackend backend = TimerBackend::Heap,
+               std::chrono::nanoseconds tick = std::chrono::milliseconds(1));
 
-  void create_timeout(std::function<void()>&& fn, std::chrono::duration<double, std::milli> timeout);
+  /**
+   * @brief Run `fn` once after `timeout`. With a `slack` the deadline is rounded up to a multiple of it, so timers
+   *
+   *        created within the same window share one deadline and fire in one batch, at most `slack` late
+   */
+  auto create_timeout(std::function<void()>&& fn, std::chrono::duration<double, std::milli> timeout,
+                      std::chrono::duration<double, std::milli> slack = {}) -> Handle;
 
-  void on_timeout(size_t pindex, BaseLazySignal& signal) { _schedulers[pindex]._signal = &signal; }
+  /**
+   * @brief Run `fn` every `period` until cancelled. The timer is re-armed in place from its previous deadline, so
+   *
+   *        ticks do not drift; ticks missed while the workers were busy are skipped
+   */
+  auto create_periodic(std::function<void()>&& fn, std::chrono::duration<double, std::milli> period) -> Handle;
 
+  void on_timeout(size_t pindex, BaseLazySignal& signal) { _schedulers[pindex]->_signal = &signal; }
+
+  /**
+   * @brief Run expired timers of the worker's own partition first, then of the others
+   */
   size_t run_timeout(size_t pindex, size_t batch_size);
 
   auto next_schedule_time(size_t pindex) -> TimePoint;
 
+  /**
+   * @brief Number of armed timers
+   */
+  size_t size();
+
  private:
-  struct Task {
+  struct Timer {
+    Callback fn;
+    TimePoint ex;
+    std::chrono::steady_clock::duration period = {};  // zero for one-shot timers
+    uint64_t tick = 0;                                // slot deadline in the wheel
+    size_t pos = 0;     // index in the heap, or level in the wheel
+    Timer* prev = nullptr;
+    Timer* next = nullptr;  // also links free timers
+    uint32_t generation = 0;
+    bool firing = false;  // taken by `pop()`, the callback is running
+  };
+
+  /**
+   * @brief Timers of one partition. Timer nodes come from a slab and are only freed with the scheduler, the generation
+   *
+   *        of a node tells whether a reference to it is still armed
+   */
+  class Scheduler {
+    friend class TimedContext;
+
    public:
-    size_t id = 0;
-    Callback fn = nullptr;
-    TimePoint ex = {};
+    Scheduler() = default;
+
+    Scheduler(const Scheduler&) = delete;
+
+    virtual ~Scheduler() = default;
 
-    bool operator>(const Task& rhs) const { return ex > rhs.ex; }
+    auto push(Callback&& fn, TimePoint ex, std::chrono::steady_clock::duration period = {}) -> Handle;
+
+    bool cancel(Timer* timer, uint32_t generation);
+
+    /**
+     * @brief Take at most `batch_size` timers expired at `now`. They stay allocated until `finish()`, after their
+     *
+     *        callbacks have run
+     */
+    size_t pop(TimePoint now, size_t batch_size, std::vector<Timer*>& timers);
+
+    /**
+     * @brief Release fired timers, periodic ones are armed again for their next deadline after `now`
+     */
+    void finish(TimePoint now, std::vector<Timer*>& timers);
+
+    auto next_time() -> TimePoint;
+
+    size_t size();
+
+   protected:
+    virtual void _insert(Timer* timer) = 0;
+
+    virtual void _remove(Timer* timer) = 0;
+
+    virtual auto _pop(TimePoint now) -> Timer* = 0;
+
+    virtual auto _next() -> TimePoint = 0;
+
+   private:
+    static constexpr size_t ChunkSize = 256;
 
-    bool operator<(const Task& rhs) const { return ex < rhs.ex; }
+    Spinlock _mtx{"timer"};
+    BaseLazySignal* _signal = nullptr;
+    std::vector<std::unique_ptr<Timer[]>> _chunks;
+    Timer* _free = nullptr;
+    size_t _size = 0;
 
-    bool operator==(const Task& rhs) const { return ex == rhs.ex; }
+    auto _alloc() -> Timer*;
+
+    void _arm(Timer* timer);
+
+    void _release(Timer* timer);
   };
 
-  class Scheduler {
-    friend class TimedContext;
+  class HeapScheduler : public Scheduler {
+   protected:
+    void _insert(Timer* timer) override;
+
+    void _remove(Timer* timer) override;
+
+    auto _pop(TimePoint now) -> Timer* override;
 
+    auto _next() -> TimePoint override;
+
+   private:
+    std::vector<Timer*> _heap;
+
+    void _place(Timer* timer, size_t pos);
+
+    void _sift_up(size_t pos);
+
+    void _sift_down(size_t pos);
+  };
+
+  /**
+   * @brief Hierarchical timing wheel of 6 levels with 64 slots each. A timer is placed on the level of the highest
+   *
+   *        6-bit digit its deadline tick differs from the current tick in, and moves down a level each time its slot is
+   *
+   *        reached, until it expires from the lowest level. Deadlines beyond the top level are clamped and re-placed
+   */
+  class WheelScheduler : public Scheduler {
    public:
-    void push(Task&& timer);
+    WheelScheduler(std::chrono::nanoseconds tick) : _start(std::chrono::steady_clock::now()), _tick(tick) {}
+
+   protected:
+    void _insert(Timer* timer) override;
+
+    void _remove(Timer* timer) override;
 
-    auto pop() -> std::optional<Task>;
+    auto _pop(TimePoint now) -> Timer* override;
+
+    auto _next() -> TimePoint override;
 
    private:
-    Spinlock _mtx;
-    std::priority_queue<Task, std::vector<Task>, std::greater<Task>> _pq_timer;
-    _impl::BaseLazySignal* _signal = nullptr;
+    static constexpr size_t LevelBits = 6;
+    static constexpr size_t LevelSlots = 1 << LevelBits;
+    static constexpr size_t LevelNum = 6;
+    static constexpr size_t ExpiredLevel = LevelNum;
+    static constexpr uint64_t MaxTick = (uint64_t(1) << (LevelBits * LevelNum)) - 1;
+
+    struct Level {
+      uint64_t occupied = 0;
+      std::array<Timer*, LevelSlots> slots = {};
+    };
+
+    TimePoint _start;
+    std::chrono::nanoseconds _tick;
+    uint64_t _elapsed = 0;
+    std::array<Level, LevelNum> _levels;
+    Timer* _expired = nullptr;
+
+    auto _deadline_tick(TimePoint ex) -> uint64_t;
+
+    auto _head(Timer* timer) -> Timer*&;
+
+    /**
+     * @brief Earliest occupied slot, lower levels always expire before higher ones
+     */
+    bool _next_slot(size_t& level, size_t& slot, uint64_t& deadline);
+
+    void _expire_slot(size_t level, size_t slot, uint64_t deadline);
   };
 
   std::atomic<size_t> _tid = 0;
-  std::vector<Scheduler> _schedulers;
+  std::vector<std::unique_ptr<Scheduler>> _schedulers;
+
+  static auto _deadline(std::chrono::duration<double, std::milli> timeout,
+                        std::chrono::duration<double, std::milli> slack) -> TimePoint;
+  inline static thread_local std::vector<Timer*>* _batch = nullptr;  // timers taken by the running `run_timeout()`
+  inline static thread_local size_t _batch_pos = 0;                  // index of the running callback in `_batch`
+};
+
+/**
+ * @brief Awaiter of `cgo::sleep()`. The timer wakes the signal inside the awaiter, no frame or shared state is
+ *
+ *        allocated unless the timer belongs to another context
+ */
+class Sleeper {
+ public:
+  Sleeper(Context& ctx, std::chrono::duration<double, std::milli> timeout) : _ctx(&ctx), _timeout(timeout) {}
+
+  /**
+   * @note Only an awaiter which is not awaited yet can be moved
+   */
+  Sleeper(Sleeper&& rhs) : Sleeper(*rhs._ctx, rhs._timeout) {}
+
+  /**
+   * @note Cancels the timer if the awaiting coroutine is destroyed before it fires
+   */
+  ~Sleeper();
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> caller);
+
+  void await_resume() { _timer = {}; }
+
+ private:
+  Context* _ctx;
+  std::chrono::duration<double, std::milli> _timeout;
+  Semaphore _signal = {0};
+  std::shared_ptr<Semaphore> _shared = nullptr;
+  TimedContext::Handle _timer;
 };
 
 }  // namespace cgo::_impl
 
 namespace cgo {
 
-Channel<Nil> timeout(Context& ctx, std::chrono::duration<double, std::milli> timeout);
+/**
+ * @brief Delivers the time into `chan()` every period, like Go `time.Ticker`. The channel holds one tick, ticks are
+ *
+ *        dropped while the reader falls behind. A ticker is a single periodic timer, nothing is allocated per tick.
+ *
+ *        Must be stopped or destroyed before its context, as it is along with the coroutine frame it lives in
+ */
+class Ticker {
+ public:
+  using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+  Ticker(Context& ctx, std::chrono::duration<double, std::milli> period);
+
+  Ticker(const Ticker&) = delete;
+
+  Ticker(Ticker&&) = delete;
+
+  ~Ticker() { stop(); }
+
+  auto chan() -> Channel<TimePoint>& { return _chan; }
+
+  /**
+   * @brief No tick is delivered after `stop()` returns. The channel is not closed, a buffered tick may remain
+   */
+  void stop() { _timer.cancel(); }
+
+ private:
+  Channel<TimePoint> _chan{1};
+  _impl::TimedContext::Handle _timer;
+};
+
+/**
+ * @brief Steady clock time, cached per event-loop iteration on workers. See `_impl::LoopClock`
+ */
+inline auto now() -> std::chrono::time_point<std::chrono::steady_clock> { return _impl::LoopClock::now(); }
+
+/**
+ * @brief A channel which receives one value after `timeout`. See `TimedContext::create_timeout()` for `slack`
+ */
+Channel<Nil> timeout(Context& ctx, std::chrono::duration<double, std::milli> timeout,
+                     std::chrono::duration<double, std::milli> slack = {});
 
-Coroutine<void> sleep(Context& ctx, std::chrono::duration<double, std::milli> timeout);
+inline auto sleep(Context& ctx, std::chrono::duration<double, std::milli> timeout) -> _impl::Sleeper {
+  return _impl::Sleeper(ctx, timeout);
+}
 
 }  // namespace cgo
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "core/schedule.h"
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/uio.h>
+#endif
+
+namespace cgo {
+
+/**
+ * @brief How sockets of a context wait for I/O
+ */
+enum class IoBackend {
+  Epoll,  // readiness from the epoll `EventContext`, then a syscall per operation
+  Uring,  // operations submitted to io_uring, falls back to epoll if the kernel lacks support
+};
+
+}  // namespace cgo
+
+namespace cgo::_impl {
+
+class UringContext;
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+
+/**
+ * @brief io_uring instance of one worker, set up with raw syscalls. SQEs queued by the owning worker are submitted
+ *
+ *        together by one `io_uring_enter()` per loop iteration, SQEs queued by other threads are submitted at once.
+ *
+ *        Only the owner reaps completions, its epoll handler watches the ring fd to wake it when parked
+ */
+class Uring {
+ public:
+  /**
+   * @brief Request in flight. `complete()` runs on the owning worker for every CQE of the request, which must stay
+   *
+   *        alive until a CQE without `IORING_CQE_F_MORE`, and the CQE of its link timeout if any
+   */
+  class Request {
+   public:
+    virtual void complete(int res, uint32_t flags) = 0;
+
+    /**
+     * @brief CQE of the link timeout of the request, `-ETIME` if it fired. The request stays alive until this one too
+     */
+    virtual void link_timeout(int res) {}
+
+   protected:
+    ~Request() = default;
+  };
+
+  static constexpr uint16_t BufferGroup = 0;
+  static constexpr uint32_t BufferNum = 256;  // power of 2
+  static constexpr uint32_t BufferSize = 16 * 1024;
+
+  static constexpr uint64_t LinkTimeoutTag = 1;  // in the `user_data` of a link timeout, requests are aligned
+
+  /**
+   * @brief Whether the kernel has what this backend needs, multishot accept and recv into provided buffers. Probed
+   *
+   *        once
+   */
+  static bool supported();
+
+  /**
+   * @brief Why `supported()` is false, e.g. to report the fallback to epoll. Empty if it is true
+   */
+  static auto unsupported_reason() -> const std::string&;
+
+  /**
+   * @brief Ring of the calling worker, nullptr on other threads
+   */
+  static auto local() -> Uring* { return _local; }
+
+  explicit Uring(unsigned entries = 256);
+
+  Uring(const Uring&) = delete;
+
+  ~Uring();
+
+  int fd() const { return _fd; }
+
+  /**
+   * @brief Queue one SQE prepared by `prep`. `req` is nullptr if the completion is not interesting
+   */
+  template <typename F>
+  void push(Request* req, F&& prep) {
+    std::unique_lock guard(_mtx);
+    auto sqe = _sqe(guard, 1);
+    prep(*sqe);
+    sqe->user_data = reinterpret_cast<uint64_t>(req);
+    _commit(1, req ? 1 : 0);
+  }
+
+  /**
+   * @brief Queue an SQE linked to `timeout`, if any. When it expires the request completes with `-ECANCELED`, and
+   *
+   *        `req->link_timeout()` gets `-ETIME`
+   */
+  template <typename F>
+  void push(Request* req, const __kernel_timespec* timeout, F&& prep) {
+    if (!timeout) {
+      push(req, std::forward<F>(prep));
+      return;
+    }
+    std::unique_lock guard(_mtx);
+    auto sqe = _sqe(guard, 2);
+    prep(*sqe);
+    sqe->user_data = reinterpret_cast<uint64_t>(req);
+    sqe->flags |= IOSQE_IO_LINK;
+    auto link = _sqe_at(_sq_local_tail + 1);
+    link->opcode = IORING_OP_LINK_TIMEOUT;
+    link->fd = -1;
+    link->addr = reinterpret_cast<uint64_t>(timeout);
+    link->len = 1;
+    link->user_data = req ? reinterpret_cast<uint64_t>(req) | LinkTimeoutTag : 0;
+    _commit(2, req ? 2 : 0);
+  }
+
+  /**
+   * @brief Cancel requests on `fd`, submitted at once since the fd is about to be closed
+   */
+  void cancel(int fd);
+
+  /**
+   * @brief Cancel one request, e.g. a multishot one
+   */
+  void cancel(Request* req);
+
+  auto buffer(uint16_t bid) -> char* { return _buffers.get() + size_t(bid) * BufferSize; }
+
+  /**
+   * @brief Give a buffer selected by a completion back to the provided buffer ring
+   */
+  void recycle(uint16_t bid);
+
+  /**
+   * @brief Called by the owning worker before it queues anything
+   */
+  void bind() { _local = this; }
+
+  /**
+   * @brief Submit queued SQEs, then complete up to `batch_size` reaped CQEs. Owner only
+   */
+  size_t run(size_t batch_size);
+
+  /**
+   * @brief Cancel all requests in flight and wait for their completions, so none of them still references a
+   *
+   *        coroutine frame destroyed afterwards. Owner only
+   */
+  void drain();
+
+ private:
+  Spinlock _mtx{"uring"};
+  int _fd = -1;
+  void* _sq_ptr = nullptr;
+  size_t _sq_size = 0;
+  void* _cq_ptr = nullptr;
+  size_t _cq_size = 0;
+  size_t _sqes_size = 0;
+
+  uint32_t _sq_entries = 0;
+  uint32_t _sq_mask = 0;
+  std::atomic<uint32_t>* _sq_head = nullptr;
+  std::atomic<uint32_t>* _sq_tail = nullptr;
+  std::atomic<uint32_t>* _sq_flags = nullptr;
+  io_uring_sqe* _sqes = nullptr;
+  uint32_t _sq_local_tail = 0;
+  uint32_t _unsubmitted = 0;
+
+  uint32_t _cq_mask = 0;
+  std::atomic<uint32_t>* _cq_head = nullptr;
+  std::atomic<uint32_t>* _cq_tail = nullptr;
+  io_uring_cqe* _cqes = nullptr;
+  std::deque<io_uring_cqe> _stashed;  // taken off the CQ by the owner to make room, completed by `run()`
+  std::atomic<size_t> _inflight = 0;
+
+  Spinlock _buf_mtx{"uring"};
+  io_uring_buf_ring* _bufs = nullptr;
+  uint16_t _buf_tail = 0;
+  std::unique_ptr<char[]> _buffers;
+
+  inline static thread_local Uring* _local = nullptr;
+
+  /**
+   * @brief `n` zeroed SQEs after the local tail, submitting queued ones first if the SQ is full. While the kernel
+   *
+   *        takes no more, the owner moves completions aside and other threads let go of `guard` for the owner to reap
+   */
+  auto _sqe(std::unique_lock<Spinlock>& guard, uint32_t n) -> io_uring_sqe*;
+
+  auto _sqe_at(uint32_t index) -> io_uring_sqe* { return &_sqes[index & _sq_mask]; }
+
+  /**
+   * @brief Publish `n` prepared SQEs carrying `requests` requests
+   */
+  void _commit(uint32_t n, size_t requests);
+
+  /**
+   * @return false if the kernel takes no more SQEs until completions are reaped (`EAGAIN`, `EBUSY`)
+   */
+  bool _submit();
+
+  /**
+   * @brief Move the CQEs posted so far to `_stashed`. Owner only
+   */
+  void _stash();
+
+  void _complete(const io_uring_cqe& cqe);
+
+  void _setup_buffer_ring();
+
+  /**
+   * @brief Unmap and close everything set up so far
+   */
+  void _release();
+};
+
+/**
+ * @brief Rings of the workers of a context
+ */
+class UringContext {
+ public:
+  /**
+   * @brief nullptr if the context uses epoll
+   */
+  static auto at(Context& ctx) -> UringContext*;
+
+  UringContext(size_t n_partition);
+
+  auto ring(size_t pindex) -> Uring& { return *_rings[pindex % _rings.size()]; }
+
+  /**
+   * @brief Ring of the calling worker if it belongs to this context, so its SQEs are batched, otherwise picked by `fd`
+   */
+  auto ring_for(int fd) -> const std::shared_ptr<Uring>&;
+
+  /**
+   * @brief Cancel requests on `fd` in every ring
+   */
+  void cancel(int fd);
+
+ private:
+  std::vector<std::shared_ptr<Uring>> _rings;  // shared with sockets holding its provided buffers
+};
+
+/**
+ * @brief One request awaited by a coroutine frame, which holds everything the request references. A request posting
+ *
+ *        a notification after its result, e.g. a zero-copy send, is done on the notification
+ */
+class UringOp : public Uring::Request {
+ public:
+  void complete(int res, uint32_t flags) override {
+    if (!(flags & IORING_CQE_F_NOTIF)) {
+      _res = res;
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+      _done();
+    }
+  }
+
+  void link_timeout(int res) override {
+    _timed_out = res == -ETIME;
+    _done();
+  }
+
+  auto wait() -> Semaphore::Awaiter { return _signal.aquire(); }
+
+  /**
+   * @return The result of the request, `-ETIME` if its link timeout expired
+   */
+  int result() const {
+    // a link timeout and a cancellation by `close()` both end the request with `-ECANCELED`, the CQE of the link
+    // timeout tells them apart
+    return _res == -ECANCELED && _timed_out ? -ETIME : _res;
+  }
+
+  /**
+   * @brief Link timeout for `Uring::push()`, nullptr if `timeout` is not positive
+   */
+  auto timeout(std::chrono::duration<double, std::milli> timeout) -> const __kernel_timespec*;
+
+ private:
+  int _res = 0;
+  bool _timed_out = false;
+  size_t _pending = 1;  // CQEs to wait for, one more with a link timeout
+  Semaphore _signal{0};
+  __kernel_timespec _ts = {};
+
+  void _done() {
+    if (--_pending == 0) {
+      _signal.release();
+    }
+  }
+};
+
+/**
+ * @brief State of a TCP socket on io_uring, shared by copies of the socket. One multishot accept queues accepted
+ *
+ *        connections, one multishot recv queues received data in provided buffers until a reader copies it out. An
+ *
+ *        armed request keeps the state alive until its last completion
+ */
+class UringSocket : public std::enable_shared_from_this<UringSocket> {
+ public:
+  /**
+   * @brief Received data held in provided buffers before the multishot recv is stopped, so a socket nobody reads
+   *
+   *        does not starve others of buffers
+   */
+  static constexpr size_t MaxChunks = 16;
+
+  explicit UringSocket(int fd) : _fd(fd) {}
+
+  ~UringSocket();
+
+  /**
+   * @return The accepted fd, or -errno
+   */
+  Coroutine<int> accept(UringContext& uring);
+
+  /**
+   * @return Bytes copied into the buffers of `iov` in order, 0 at the end of the stream, or -errno. `-ETIME` on
+   *
+   *         timeout, `-ECANCELED` once the socket is closed
+   */
+  Coroutine<int> recv(Context& ctx, UringContext& uring, std::span<const ::iovec> iov,
+                      std::chrono::duration<double, std::milli> timeout, std::chrono::duration<double, std::milli> slack);
+
+  /**
+   * @brief Whether the multishot recv was started, so received data may be held in provided buffers and must be
+   *
+   *        read by `recv()`
+   */
+  bool buffering();
+
+  /**
+   * @brief Provided buffers holding received data nobody has read yet
+   */
+  size_t held();
+
+ private:
+  struct Waiter {
+    std::atomic<int> state = 0;  // 1 if woken by a completion, -1 by the timeout
+    Semaphore signal = {0};
+  };
+
+  struct Chunk {
+    uint16_t bid;
+    uint32_t len;
+    uint32_t off = 0;
+  };
+
+  class Stream : public Uring::Request {
+   public:
+    UringSocket* const owner;
+    bool const accept;
+    bool armed = false;
+    std::shared_ptr<UringSocket> keepalive;  // while armed
+
+    Stream(UringSocket* owner, bool accept) : owner(owner), accept(accept) {}
+
+    void complete(int res, uint32_t flags) override;
+  };
+
+  int _fd;
+  Spinlock _mtx{"uring"};
+  std::vector<std::shared_ptr<Waiter>> _waiters;  // woken by every completion to check again
+
+  Stream _acceptor{this, true};
+  std::deque<int> _accepted;
+  int _accept_error = 0;
+
+  Stream _receiver{this, false};
+  std::shared_ptr<Uring> _recv_ring;  // owner of the provided buffers in `_chunks`
+  std::deque<Chunk> _chunks;
+  int _recv_error = 0;
+  bool _eof = false;
+  bool _starved = false;  // the multishot recv ran out of provided buffers
+  bool _paused = false;   // the multishot recv is being cancelled for holding `MaxChunks`
+
+  void _arm(Uring& ring, Stream& stream);
+
+  static void _wake(Waiter& waiter, int state);
+};
+
+#endif
+
+}  // namespace cgo::_impl
@@ -0,0 +1,111 @@
+#include "core/channel.h"
+
+#include "core/context.h"
+#include "mtest.h"
+
+const size_t ping_pong_num = 1e5;
+
+cgo::Coroutine<void> framed_send(cgo::Channel<int>& chan, int x) { co_await (chan << x); }
+
+cgo::Coroutine<void> framed_recv(cgo::Channel<int>& chan, int& x) { co_await (chan >> x); }
+
+/**
+ * @param framed: Wrap each channel operation with a coroutine, as what the channel operators did before they became
+ *                awaiters
+ */
+double ping_pong_bench(bool framed) {
+  cgo::Channel<int> ping, pong;
+  std::atomic<int> res = 0;
+
+  cgo::Context ctx;
+  ctx.startup(1);
+  auto begin = std::chrono::steady_clock::now();
+  cgo::spawn(ctx, [](decltype(ping) ping, decltype(pong) pong, bool framed) -> cgo::Coroutine<void> {
+    for (int i = 0; i < ping_pong_num; ++i) {
+      int x = -1;
+      if (framed) {
+        co_await framed_recv(ping, x);
+        co_await framed_send(pong, x);
+      } else {
+        co_await (ping >> x);
+        co_await (pong << x);
+      }
+    }
+  }(ping, pong, framed));
+  cgo::spawn(ctx, [](decltype(ping) ping, decltype(pong) pong, decltype(res)& res, bool framed) -> cgo::Coroutine<void> {
+    for (int i = 0; i < ping_pong_num; ++i) {
+      int x = -1;
+      if (framed) {
+        co_await framed_send(ping, i);
+        co_await framed_recv(pong, x);
+      } else {
+        co_await (ping << i);
+        co_await (pong >> x);
+      }
+      ASSERT(x == i, "x=%d, i=%d", x, i);
+    }
+    res.fetch_add(1);
+  }(ping, pong, res, framed));
+  while (res < 1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto end = std::chrono::steady_clock::now();
+  ctx.shutdown();
+  return ping_pong_num / std::chrono::duration<double>(end - begin).count();
+}
+
+TEST(channel, bench_ping_pong) {
+  double framed = ping_pong_bench(true);
+  double awaiter = ping_pong_bench(false);
+  ::printf("round trips per second: framed=%.0f, awaiter=%.0f\n", framed, awaiter);
+}
+
+const size_t busy_task_num = 128;
+const size_t busy_ping_pong_num = 1e4;
+
+/**
+ * @brief Round trip latency of a ping-pong pair, while the same worker is busy with other yielding tasks
+ */
+double busy_ping_pong_bench() {
+  cgo::Channel<int> ping, pong;
+  std::atomic<int> res = 0;
+  std::atomic<bool> done = false;
+
+  cgo::Context ctx;
+  ctx.startup(1);
+  for (int i = 0; i < busy_task_num; ++i) {
+    cgo::spawn(ctx, [](decltype(done)& done) -> cgo::Coroutine<void> {
+      while (!done) {
+        co_await cgo::yield();
+      }
+    }(done));
+  }
+  cgo::spawn(ctx, [](decltype(ping) ping, decltype(pong) pong) -> cgo::Coroutine<void> {
+    for (int i = 0; i < busy_ping_pong_num; ++i) {
+      int x = -1;
+      co_await (ping >> x);
+      co_await (pong << x);
+    }
+  }(ping, pong));
+  auto begin = std::chrono::steady_clock::now();
+  cgo::spawn(ctx, [](decltype(ping) ping, decltype(pong) pong, decltype(res)& res) -> cgo::Coroutine<void> {
+    for (int i = 0; i < busy_ping_pong_num; ++i) {
+      int x = -1;
+      co_await (ping << i);
+      co_await (pong >> x);
+      ASSERT(x == i, "x=%d, i=%d", x, i);
+    }
+    res.fetch_add(1);
+  }(ping, pong, res));
+  while (res < 1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto end = std::chrono::steady_clock::now();
+  done = true;
+  ctx.shutdown();
+  return std::chrono::duration<double, std::micro>(end - begin).count() / busy_ping_pong_num;
+}
+
+TEST(channel, bench_busy_ping_pong) {
+  ::printf("round trip latency with %lu busy tasks: %.2fus\n", busy_task_num, busy_ping_pong_bench());
+}
@@ -0,0 +1,36 @@
+#include "core/event.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "mtest.h"
+
+const size_t bench_cycle_num = 100000;
+
+TEST(event, bench_arm_fire) {
+  cgo::_impl::EventContext::Handler handler;
+  int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  uint64_t one = 1;
+  uint64_t data = 0;
+  handler.add(fd, cgo::_impl::Event::IN | cgo::_impl::Event::ONESHOT, [](cgo::_impl::Event) {});
+
+  // a socket wait arms its fd with a callback holding shared state, then the readiness fires it
+  auto state = std::make_shared<size_t>(0);
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < bench_cycle_num; ++i) {
+    handler.mod(fd, cgo::_impl::Event::IN | cgo::_impl::Event::ONESHOT, [state, fd, &data](cgo::_impl::Event) {
+      ::read(fd, &data, sizeof(data));
+      ++*state;
+    });
+    ::write(fd, &one, sizeof(one));
+    handler.handle(128, 0);
+  }
+  auto cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+  ASSERT(*state == bench_cycle_num, "fired=%lu", *state);
+  printf("arm/fire: %.0fns per cycle\n", cost.count() * 1e9 / bench_cycle_num);
+
+  handler.del(fd);
+  ::close(fd);
+}
@@ -0,0 +1,120 @@
+#include "core/context.h"
+#include "mtest.h"
+
+const size_t exec_num = 4;
+
+const size_t bench_loop = 1e6;
+
+cgo::Coroutine<void> framed_yield() { co_await cgo::yield(); }
+
+cgo::Coroutine<void> framed_aquire(cgo::Semaphore& sem) { co_await sem.aquire(); }
+
+/**
+ * @param framed: Wrap each operation with a coroutine, as what `cgo::yield()` and `Semaphore::aquire()` did before
+ *                they became awaiters
+ */
+double awaiter_bench(bool framed) {
+  std::atomic<int> res = 0;
+  cgo::Semaphore sem(1);
+
+  cgo::Context ctx;
+  ctx.startup(1);
+  auto begin = std::chrono::steady_clock::now();
+  cgo::spawn(ctx, [](decltype(sem)& sem, decltype(res)& res, bool framed) -> cgo::Coroutine<void> {
+    for (int i = 0; i < bench_loop; i++) {
+      if (framed) {
+        co_await framed_aquire(sem);
+        sem.release();
+        co_await framed_yield();
+      } else {
+        co_await sem.aquire();
+        sem.release();
+        co_await cgo::yield();
+      }
+    }
+    res.fetch_add(1);
+  }(sem, res, framed));
+  while (res < 1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto end = std::chrono::steady_clock::now();
+  ctx.shutdown();
+  return bench_loop / std::chrono::duration<double>(end - begin).count();
+}
+
+TEST(schedule, bench_awaiter) {
+  double framed = awaiter_bench(true);
+  double awaiter = awaiter_bench(false);
+  ::printf("aquire+release+yield per second: framed=%.0f, awaiter=%.0f\n", framed, awaiter);
+}
+
+const size_t scaling_root_num = 256;
+const size_t scaling_child_num = 16;
+const size_t scaling_yield_num = 100;
+
+double spawn_yield_bench(size_t n_worker) {
+  std::atomic<size_t> res = 0;
+
+  cgo::Context ctx;
+  ctx.startup(n_worker);
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < scaling_root_num; ++i) {
+    cgo::spawn(ctx, [](decltype(res)& res) -> cgo::Coroutine<void> {
+      for (int j = 0; j < scaling_child_num; ++j) {
+        cgo::spawn(cgo::this_coroutine_ctx(), [](decltype(res)& res) -> cgo::Coroutine<void> {
+          for (int k = 0; k < scaling_yield_num; ++k) {
+            co_await cgo::yield();
+          }
+          res.fetch_add(1);
+        }(res));
+      }
+      co_return;
+    }(res));
+  }
+  while (res < scaling_root_num * scaling_child_num) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto end = std::chrono::steady_clock::now();
+  ctx.shutdown();
+  return scaling_root_num * scaling_child_num * (scaling_yield_num + 1) /
+         std::chrono::duration<double>(end - begin).count();
+}
+
+TEST(schedule, bench_scaling) {
+  for (size_t n = 1; n <= exec_num; n *= 2) {
+    ::printf("workers=%lu, spawn+yield per second: %.0f\n", n, spawn_yield_bench(n));
+  }
+}
+
+const size_t wakeup_num = 50;
+
+TEST(schedule, bench_wakeup) {
+  cgo::Context ctx;
+  ctx.startup(exec_num);
+
+  // every spawn lands on an idle context, so its latency is the time to wake a parked worker
+  std::chrono::duration<double, std::micro> total(0);
+  for (size_t i = 0; i < wakeup_num; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    std::atomic<bool> done = false;
+    std::chrono::steady_clock::time_point start_at;
+    std::chrono::steady_clock::time_point run_at;
+    start_at = std::chrono::steady_clock::now();
+    cgo::spawn(ctx, [](auto& run_at, std::atomic<bool>& done) -> cgo::Coroutine<void> {
+      run_at = std::chrono::steady_clock::now();
+      done = true;
+      co_return;
+    }(run_at, done));
+    while (!done) {
+      std::this_thread::yield();
+    }
+    total += run_at - start_at;
+  }
+
+  auto cpu = std::clock();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  double idle_cpu_ms = double(std::clock() - cpu) * 1000 / CLOCKS_PER_SEC;
+  ctx.shutdown();
+  printf("wake-up latency: %.2fus, cpu time of %lu idle workers in 200ms: %.2fms\n", total.count() / wakeup_num,
+         exec_num, idle_cpu_ms);
+}
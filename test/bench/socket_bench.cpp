@@ -0,0 +1,70 @@
+#include "core/event.h"
+
+#include <chrono>
+#include <cstdio>
+
+#include "core/context.h"
+#include "mtest.h"
+#include "socket_fixture.h"
+
+TEST(socket, bench_zerocopy) {
+  const size_t msg_size = 4 << 20;
+  const size_t msg_num = 64;
+  on_backends([&](SocketFixture& fixture, cgo::IoBackend backend) {
+    for (bool zerocopy : {false, true}) {
+      auto [listener, port] = fixture.open(cgo::Socket::Protocol::TCP);
+      size_t received = 0;
+      size_t done = fixture.wg().load();
+      auto begin = std::chrono::steady_clock::now();
+      cgo::spawn(fixture.ctx(), sink(listener, received, fixture.wg()));
+      cgo::spawn(fixture.ctx(), stream(port, zerocopy, msg_size, msg_num, fixture.wg()));
+      fixture.wait(done + 2);
+      auto cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+      ASSERT(received == msg_size * msg_num, "received=%lu", received);
+      printf("%s %s: %.0f MB/s over loopback, %lu MB messages\n",
+             backend == cgo::IoBackend::Epoll ? "epoll" : "io_uring", zerocopy ? "send_zerocopy" : "send",
+             received / cost.count() / (1 << 20), msg_size >> 20);
+    }
+  });
+}
+
+TEST(socket, bench_udp_batch) {
+  const size_t rounds = 2000;
+  on_backends([&](SocketFixture& fixture, cgo::IoBackend backend) {
+    auto [server, port] = fixture.open(cgo::Socket::Protocol::UDP);
+    auto [client, _] = fixture.open(cgo::Socket::Protocol::UDP);
+    size_t received = 0;
+    auto begin = std::chrono::steady_clock::now();
+    cgo::spawn(fixture.ctx(), batch_echo(server, rounds * 32, fixture.wg()));
+    cgo::spawn(fixture.ctx(), batch_ping(client, port, rounds, received, fixture.wg()));
+    fixture.wait(2);
+    auto cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+    ASSERT(received == rounds * 32, "received=%lu", received);
+    printf("%s: %.0f datagrams/s echoed in batches of 32\n", backend == cgo::IoBackend::Epoll ? "epoll" : "io_uring",
+           2 * received / cost.count());
+  });
+}
+
+TEST(socket, bench_udp_gso) {
+  const size_t segment_size = 1000;
+  const size_t per_round = 64;
+  const size_t rounds = 2000;
+  on_backends([&](SocketFixture& fixture, cgo::IoBackend) {
+    for (bool offload : {false, true}) {
+      auto [server, port] = fixture.open(cgo::Socket::Protocol::UDP);
+      ASSERT(server.set_gro(offload), "set_gro failed");
+      auto [client, _] = fixture.open(cgo::Socket::Protocol::UDP);
+      size_t received = 0;
+      size_t done = fixture.wg().load();
+      auto begin = std::chrono::steady_clock::now();
+      cgo::spawn(fixture.ctx(), gro_sink(server, per_round, rounds, received, fixture.wg()));
+      cgo::spawn(fixture.ctx(), gso_source(client, port, offload, segment_size, per_round, rounds, fixture.wg()));
+      fixture.wait(done + 2);
+      auto cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+      ASSERT(received == per_round * rounds, "received=%lu", received);
+      printf("%s: %.0f datagrams/s, %.0f MB/s over loopback, %lu byte datagrams\n",
+             offload ? "UDP_SEGMENT + UDP_GRO" : "sendmmsg + recvmmsg", received / cost.count(),
+             received * segment_size / cost.count() / (1 << 20), segment_size);
+    }
+  }, {cgo::IoBackend::Epoll});
+}
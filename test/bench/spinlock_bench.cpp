@@ -0,0 +1,37 @@
+#include "core/spinlock.h"
+
+#include <chrono>
+#include <ctime>
+#include <mutex>
+#include <thread>
+
+#include "mtest.h"
+
+const size_t foo_loop = 100000;
+
+TEST(spinlock, bench_oversubscribed) {
+  // more threads than cores: a waiter spinning on a preempted holder burns its whole time slice
+  size_t n_thread = 16 * std::max(1u, std::thread::hardware_concurrency());
+  size_t loop = 10 * foo_loop;
+  cgo::_impl::Spinlock mtx;
+  size_t counter = 0;
+  auto wall = std::chrono::steady_clock::now();
+  auto cpu = std::clock();
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < n_thread; ++i) {
+    workers.emplace_back([&mtx, &counter, loop]() {
+      for (size_t j = 0; j < loop; ++j) {
+        std::unique_lock guard(mtx);
+        ++counter;
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count();
+  double cpu_s = double(std::clock() - cpu) / CLOCKS_PER_SEC;
+  printf("%lu threads: %.2fM locks/s, wall %.3fs, cpu %.3fs\n", n_thread, n_thread * loop / wall_s / 1e6, wall_s,
+         cpu_s);
+  ASSERT(counter == n_thread * loop, "counter=%lu", counter);
+}
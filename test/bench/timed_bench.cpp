@@ -0,0 +1,70 @@
+#include "core/timed.h"
+
+#include <ctime>
+#include <thread>
+
+#include "core/context.h"
+#include "mtest.h"
+
+const size_t exec_num = 4;
+const size_t foo_num = 10000;
+const size_t foo_loop = 100;
+const size_t bench_timer_num = 1000000;
+
+void bench_timers(cgo::TimerBackend backend, const char* name) {
+  cgo::_impl::TimedContext timed(1, backend);
+  size_t fired = 0;
+
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < bench_timer_num; ++i) {
+    timed.create_timeout([&fired]() { ++fired; }, std::chrono::microseconds(std::rand() % 1000000));
+  }
+  auto insert_cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+  ASSERT(timed.size() == bench_timer_num, "");
+
+  // expiry cost excludes the time spent waiting for deadlines
+  auto cpu = std::clock();
+  while (fired < bench_timer_num) {
+    if (timed.run_timeout(0, 1024) == 0) {
+      std::this_thread::sleep_until(std::min(timed.next_schedule_time(0), std::chrono::steady_clock::now() +
+                                                                              std::chrono::milliseconds(1)));
+    }
+  }
+  double expire_cpu_ms = double(std::clock() - cpu) * 1000 / CLOCKS_PER_SEC;
+  ASSERT(timed.size() == 0, "");
+  printf("%s: insert %.2fM timers/s, cpu time to expire %lu timers: %.0fms\n", name,
+         bench_timer_num / insert_cost.count() / 1e6, bench_timer_num, expire_cpu_ms);
+}
+
+TEST(timed, bench_timers) {
+  bench_timers(cgo::TimerBackend::Heap, "heap");
+  bench_timers(cgo::TimerBackend::Wheel, "wheel");
+}
+
+double bench_loop_clock(bool precise) {
+  std::atomic<size_t> end_num = 0;
+  cgo::Context ctx;
+  ctx.startup(exec_num, {.precise_clock = precise});
+  auto cpu = std::clock();
+  for (int i = 0; i < foo_num; ++i) {
+    cgo::spawn(ctx, [](std::atomic<size_t>& end_num) -> cgo::Coroutine<void> {
+      auto& ctx = cgo::this_coroutine_ctx();
+      for (int i = 0; i < foo_loop; ++i) {
+        co_await cgo::sleep(ctx, std::chrono::microseconds(std::rand() % 100));
+      }
+      end_num.fetch_add(1);
+    }(end_num));
+  }
+  while (end_num < foo_num) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ctx.shutdown();
+  return double(std::clock() - cpu) * 1000 / CLOCKS_PER_SEC;
+}
+
+TEST(timed, bench_loop_clock) {
+  double precise_ms = bench_loop_clock(true);
+  double cached_ms = bench_loop_clock(false);
+  printf("cpu time of %lu sleeps: precise clock %.0fms, loop clock %.0fms\n", foo_num * foo_loop, precise_ms,
+         cached_ms);
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <initializer_list>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "core/context.h"
+#include "core/event.h"
+#include "mtest.h"
+
+// a context asked for io_uring may fall back to epoll, which is told instead of testing epoll twice
+inline bool uring_fallback(cgo::Context& ctx, cgo::IoBackend backend) {
+  if (backend != cgo::IoBackend::Uring || cgo::_impl::UringContext::at(ctx)) {
+    return false;
+  }
+  ASSERT(!cgo::_impl::Uring::supported(), "io_uring supported, but not used");
+  printf("io_uring skipped: %s\n", cgo::_impl::Uring::unsupported_reason().c_str());
+  return true;
+}
+
+/**
+ * @brief Sockets of a case on loopback, and a count of its coroutines done. The sockets are closed along with the
+ *
+ *        fixture, after its context is shut down
+ */
+class SocketFixture {
+ public:
+  explicit SocketFixture(cgo::Context& ctx) : _ctx(ctx) {}
+
+  SocketFixture(const SocketFixture&) = delete;
+
+  ~SocketFixture() {
+    for (auto& sock : _socks) {
+      sock.close();
+    }
+  }
+
+  auto ctx() -> cgo::Context& { return _ctx; }
+
+  /**
+   * @brief Added to by each coroutine of the case once done
+   */
+  auto wg() -> std::atomic<size_t>& { return _wg; }
+
+  /**
+   * @brief A socket bound to a port of its own, listening if TCP
+   */
+  auto open(cgo::Socket::Protocol protocol) -> std::pair<cgo::Socket, uint16_t> {
+    auto sock = cgo::Socket::create(_ctx, protocol, cgo::Socket::AddressFamily::IPv4);
+    uint16_t port = _next_port++;
+    ASSERT(sock.bind("127.0.0.1", port), "bind %u failed", port);
+    if (protocol == cgo::Socket::Protocol::TCP) {
+      ASSERT(sock.listen(), "listen %u failed", port);
+    }
+    _socks.push_back(sock);
+    return {sock, port};
+  }
+
+  /**
+   * @brief Wait until `n` coroutines of the case are done
+   */
+  void wait(size_t n) {
+    while (_wg.load() < n) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+ private:
+  cgo::Context& _ctx;
+  std::atomic<size_t> _wg = 0;
+  std::vector<cgo::Socket> _socks;
+  uint16_t _next_port = 8083;
+};
+
+/**
+ * @brief Run `fn(fixture, backend)` on a context of its own per io backend, io_uring skipped where unsupported
+ */
+template <typename Fn>
+void on_backends(Fn&& fn,
+                 std::initializer_list<cgo::IoBackend> backends = {cgo::IoBackend::Epoll, cgo::IoBackend::Uring}) {
+  for (auto backend : backends) {
+    cgo::Context ctx;
+    ctx.startup(1, {.io_backend = backend});
+    if (uring_fallback(ctx, backend)) {
+      ctx.shutdown();
+      continue;
+    }
+    SocketFixture fixture(ctx);
+    fn(fixture, backend);
+    ctx.shutdown();
+  }
+}
+
+// peers shared by the socket tests and benchmarks
+
+inline cgo::Coroutine<void> sink(cgo::Socket listener, size_t& received, std::atomic<size_t>& wg) {
+  auto conn = co_await listener.accept();
+  if (conn) {
+    std::vector<std::byte> buffer(1 << 20);
+    while (true) {
+      auto n = co_await conn->recv_into(buffer);
+      if (!n) {
+        break;
+      }
+      received += *n;
+    }
+    conn->close();
+  }
+  wg.fetch_add(1);
+}
+
+inline cgo::Coroutine<void> stream(uint16_t port, bool zerocopy, size_t msg_size, size_t msg_num,
+                                   std::atomic<size_t>& wg) {
+  auto sock = cgo::Socket::create(cgo::this_coroutine_ctx(), cgo::Socket::Protocol::TCP,
+                                  cgo::Socket::AddressFamily::IPv4);
+  if (co_await sock.connect("127.0.0.1", port)) {
+    std::vector<std::byte> payload(msg_size, std::byte('z'));
+    for (size_t i = 0; i < msg_num; ++i) {
+      auto res = zerocopy ? co_await sock.send_zerocopy(payload) : co_await sock.send(std::span(payload));
+      if (!res) {
+        break;
+      }
+    }
+  }
+  sock.close();
+  wg.fetch_add(1);
+}
+
+inline cgo::Coroutine<void> batch_echo(cgo::Socket sock, size_t total, std::atomic<size_t>& wg) {
+  cgo::DatagramBatch batch(64);
+  for (size_t echoed = 0; echoed < total;) {
+    auto n = co_await sock.recv_batch(batch, std::chrono::seconds(5));
+    // sent back to their senders as received
+    if (!n || !(co_await sock.send_batch(batch))) {
+      break;
+    }
+    echoed += *n;
+  }
+  wg.fetch_add(1);
+}
+
+inline cgo::Coroutine<void> batch_ping(cgo::Socket sock, uint16_t port, size_t rounds, size_t& received,
+                                       std::atomic<size_t>& wg) {
+  auto server = *cgo::Endpoint::from("127.0.0.1", port);
+  cgo::DatagramBatch out(32, 64);
+  cgo::DatagramBatch in(32, 64);
+  for (size_t round = 0; round < rounds; ++round) {
+    out.clear();
+    for (size_t i = 0; i < out.capacity(); ++i) {
+      out.push(std::as_bytes(std::span(&i, 1)), server);
+    }
+    if (!(co_await sock.send_batch(out))) {
+      break;
+    }
+    for (size_t got = 0; got < out.capacity();) {
+      auto n = co_await sock.recv_batch(in, std::chrono::seconds(5));
+      if (!n) {
+        break;
+      }
+      for (size_t i = 0; i < *n; ++i) {
+        if (in.data(i).size() == sizeof(size_t) && in.peer(i).port() == port) {
+          ++received;
+        }
+      }
+      got += *n;
+    }
+  }
+  wg.fetch_add(1);
+}
+
+inline cgo::Coroutine<void> gro_sink(cgo::Socket sock, size_t per_round, size_t rounds, size_t& received,
+                                     std::atomic<size_t>& wg) {
+  // whole coalesced datagrams fit in an entry
+  cgo::DatagramBatch batch(16, 65536);
+  cgo::DatagramBatch ack(1, 1);
+  for (size_t round = 0; round < rounds; ++round) {
+    for (size_t got = 0; got < per_round;) {
+      auto n = co_await sock.recv_batch(batch, std::chrono::seconds(5));
+      if (!n) {
+        wg.fetch_add(1);
+        co_return;
+      }
+      for (size_t i = 0; i < *n; ++i) {
+        size_t segment_size = batch.segment_size(i);
+        size_t len = batch.data(i).size();
+        size_t segments = segment_size ? (len + segment_size - 1) / segment_size : 1;
+        got += segments;
+        received += segments;
+      }
+      if (got >= per_round) {
+        ack.clear();
+        ack.push(batch.data(0).first(1), batch.peer(0));
+        co_await sock.send_batch(ack);
+      }
+    }
+  }
+  wg.fetch_add(1);
+}
+
+inline cgo::Coroutine<void> gso_source(cgo::Socket sock, uint16_t port, bool offload, size_t segment_size,
+                                       size_t per_round, size_t rounds, std::atomic<size_t>& wg) {
+  auto server = *cgo::Endpoint::from("127.0.0.1", port);
+  std::vector<std::byte> payload(segment_size * per_round, std::byte('g'));
+  cgo::DatagramBatch out(per_round, offload ? payload.size() : segment_size);
+  cgo::DatagramBatch ack(1, 16);
+  for (size_t round = 0; round < rounds; ++round) {
+    out.clear();
+    if (offload) {
+      // one buffer, split into datagrams by the kernel
+      out.push(payload, server, segment_size);
+    } else {
+      for (size_t i = 0; i < per_round; ++i) {
+        out.push(std::span(payload).subspan(i * segment_size, segment_size), server);
+      }
+    }
+    if (!(co_await sock.send_batch(out)) || !(co_await sock.recv_batch(ack, std::chrono::seconds(5)))) {
+      break;
+    }
+  }
+  wg.fetch_add(1);
+}
@@ -215,7 +215,7 @@ void multi_ctx_nowait_test(int buffer_size) {
     }
 
     // make sure reader pop value out from channel
-    cgo::sleep(cgo::this_coroutine_ctx(), std::chrono::milliseconds(10));
+    co_await cgo::sleep(cgo::this_coroutine_ctx(), std::chrono::milliseconds(10));
     w_res.fetch_add(1);
   }(chans, w_res));
 
@@ -0,0 +1,97 @@
+#include "core/event.h"
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "mtest.h"
+
+TEST(event, stale_callback) {
+  cgo::_impl::EventContext::Handler handler;
+  int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  uint64_t one = 1;
+  int first = 0;
+  int second = 0;
+  handler.add(fd, cgo::_impl::Event::IN, [&first](cgo::_impl::Event) { ++first; });
+  ::write(fd, &one, sizeof(one));
+  // re-armed before the pending readiness is handled, only the new callback may run
+  handler.mod(fd, cgo::_impl::Event::IN, [&second](cgo::_impl::Event) { ++second; });
+  handler.handle(128, 0);
+  ASSERT(first == 0 && second == 1, "first=%d, second=%d", first, second);
+
+  handler.del(fd);
+  ::write(fd, &one, sizeof(one));
+  ASSERT(handler.handle(128, 0) == 0, "");
+  ASSERT(handler.size() == 0, "");
+  ::close(fd);
+}
+
+TEST(event, watch) {
+  cgo::_impl::EventContext::Handler handler;
+  int fds[2];
+  ASSERT(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0, "");
+  handler.watch(fds[0]);
+  handler.handle(128, 0);
+
+  // writable since registered, and nobody waited: cached
+  ASSERT(!handler.wait(fds[0], cgo::_impl::Event::OUT, [](cgo::_impl::Event) {}), "");
+
+  // a reader and a writer wait at the same time
+  int readable = 0;
+  int writable = 0;
+  ASSERT(handler.wait(fds[0], cgo::_impl::Event::IN, [&readable](cgo::_impl::Event) { ++readable; }), "");
+  ASSERT(handler.wait(fds[0], cgo::_impl::Event::OUT, [&writable](cgo::_impl::Event) { ++writable; }), "");
+  char c = 0;
+  ::write(fds[1], &c, 1);
+  handler.handle(128, 0);
+  ASSERT(readable == 1 && writable == 1, "readable=%d, writable=%d", readable, writable);
+
+  // readiness nobody waited for is kept until taken
+  ::write(fds[1], &c, 1);
+  handler.handle(128, 0);
+  ASSERT(!handler.wait(fds[0], cgo::_impl::Event::IN, [&readable](cgo::_impl::Event) { ++readable; }), "");
+  ASSERT(handler.wait(fds[0], cgo::_impl::Event::IN, [&readable](cgo::_impl::Event) { ++readable; }), "");
+  handler.unwait(fds[0], cgo::_impl::Event::IN);
+  ::write(fds[1], &c, 1);
+  handler.handle(128, 0);
+  ASSERT(readable == 1, "readable=%d", readable);
+
+  handler.del(fds[0]);
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST(event, partitioned_slots) {
+  const size_t n_partition = 4;
+  cgo::_impl::EventContext ctx(n_partition);
+  std::vector<int> fds;
+  for (size_t i = 0; i < 2 * n_partition; ++i) {
+    fds.push_back(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+  }
+  // each fd on the handler it is spread to, and every fd again on handler 0, as the own fds of a worker are
+  std::vector<int> fired(fds.size(), 0);
+  for (size_t i = 0; i < fds.size(); ++i) {
+    auto& handler = i < n_partition ? ctx.handler(fds[i]) : ctx.handler(0);
+    handler.add(fds[i], cgo::_impl::Event::IN, [&fired, i](cgo::_impl::Event) { ++fired[i]; });
+  }
+  uint64_t one = 1;
+  for (int fd : fds) {
+    ::write(fd, &one, sizeof(one));
+  }
+  for (size_t i = 0; i < n_partition; ++i) {
+    ctx.run_handler(i, 128, std::chrono::milliseconds(0));
+  }
+  for (size_t i = 0; i < fds.size(); ++i) {
+    ASSERT(fired[i] == 1, "fd=%d, fired=%d", fds[i], fired[i]);
+  }
+  for (size_t i = 0; i < fds.size(); ++i) {
+    auto& handler = i < n_partition ? ctx.handler(fds[i]) : ctx.handler(0);
+    handler.del(fds[i]);
+    ::close(fds[i]);
+  }
+  for (size_t i = 0; i < n_partition; ++i) {
+    ASSERT(ctx.handler(i).size() == 0, "");
+  }
+}
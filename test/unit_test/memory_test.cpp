@@ -0,0 +1,90 @@
+#include "core/memory.h"
+
+#include <thread>
+
+#include "core/context.h"
+#include "mtest.h"
+
+const size_t exec_num = 4;
+const size_t foo_num = 1000;
+const size_t foo_loop = 100;
+
+size_t live_frames() {
+  size_t n = 0;
+  for (auto& s : cgo::_impl::FramePool::stats()) {
+    n += s.live_frames;
+  }
+  return n;
+}
+
+cgo::Coroutine<int> bar(int i) { co_return i; }
+
+cgo::Coroutine<int> foo(int n) {
+  int res = 0;
+  for (int i = 0; i < n; ++i) {
+    res += co_await bar(i);
+  }
+  co_return res;
+}
+
+TEST(memory, frame_recycle) {
+  size_t base = live_frames();
+  {
+    auto f = foo(foo_loop);
+    cgo::_impl::FrameOperator::init(f);
+    ASSERT(live_frames() == base + 1, "live=%lu, base=%lu", live_frames(), base);
+    while (!cgo::_impl::FrameOperator::done(f)) {
+      cgo::_impl::FrameOperator::resume(f);
+    }
+    ASSERT(f.await_resume() == foo_loop * (foo_loop - 1) / 2, "");
+  }
+  ASSERT(live_frames() == base, "live=%lu, base=%lu", live_frames(), base);
+
+  // steady state: recycled frames are served from the cached blocks
+  auto before = cgo::_impl::FramePool::stats();
+  {
+    auto f = foo(foo_loop);
+    cgo::_impl::FrameOperator::init(f);
+    while (!cgo::_impl::FrameOperator::done(f)) {
+      cgo::_impl::FrameOperator::resume(f);
+    }
+  }
+  auto after = cgo::_impl::FramePool::stats();
+  for (size_t i = 0; i < before.size(); ++i) {
+    ASSERT(before[i].cached_frames == after[i].cached_frames, "class %lu grows", i);
+  }
+}
+
+TEST(memory, cross_thread_free) {
+  size_t base = live_frames();
+  std::vector<cgo::Coroutine<int>> frames;
+  for (int i = 0; i < foo_num; ++i) {
+    frames.emplace_back(bar(i));
+  }
+  ASSERT(live_frames() == base + foo_num, "");
+  std::thread th([&frames]() { frames.clear(); });
+  th.join();
+  ASSERT(live_frames() == base, "live=%lu, base=%lu", live_frames(), base);
+}
+
+TEST(memory, spawn) {
+  std::atomic<int> res = 0;
+  size_t base = live_frames();
+
+  cgo::Context ctx;
+  ctx.startup(exec_num);
+  for (int i = 0; i < foo_num; i++) {
+    cgo::spawn(ctx, [](std::atomic<int>& res) -> cgo::Coroutine<void> {
+      for (int i = 0; i < foo_loop; i++) {
+        co_await foo(2);
+        co_await cgo::yield();
+      }
+      res.fetch_add(1);
+    }(res));
+  }
+  while (res < foo_num) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  ctx.shutdown();
+  ASSERT(live_frames() == base, "live=%lu, base=%lu", live_frames(), base);
+}
@@ -150,4 +150,32 @@ TEST(schedule, multi_ctx_force_stop) {
   }
   ctx1.shutdown();
   ctx2.shutdown();
-}
\ No newline at end of file
+}
+
+TEST(schedule, spawn_on) {
+  std::atomic<int> res = 0;
+  std::array<std::thread::id, foo_num> tids;
+
+  cgo::Context ctx;
+  ctx.startup(exec_num);
+  for (int i = 0; i < foo_num; ++i) {
+    cgo::spawn_on(ctx, i % exec_num, [](decltype(tids)& tids, decltype(res)& res, int i) -> cgo::Coroutine<void> {
+      tids[i] = std::this_thread::get_id();
+      co_await cgo::yield();
+      res.fetch_add(1);
+    }(tids, res, i));
+  }
+  while (res < foo_num) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  ctx.shutdown();
+  for (int i = exec_num; i < foo_num; ++i) {
+    ASSERT(tids[i] == tids[i % exec_num], "task %d is not placed on worker %lu", i, i % exec_num);
+  }
+}
+
+TEST(schedule, shutdown_unstarted) {
+  cgo::Context ctx;
+  ctx.shutdown();
+  ASSERT(ctx.closed(), "");
+}
@@ -1,4 +1,6 @@
+#include <array>
 #include <cmath>
+#include <cstdio>
 #include <iostream>
 #include <random>
 
@@ -7,6 +9,7 @@
 #include "core/event.h"
 #include "core/timed.h"
 #include "mtest.h"
+#include "socket_fixture.h"
 
 struct Config {
  public:
@@ -26,9 +29,12 @@ struct Config {
 
   size_t test_duration_sec = 10;
 
+  cgo::IoBackend io_backend = cgo::IoBackend::Epoll;
+
   std::string str() const {
     std::ostringstream oss;
     oss << "address family: " << (is_v6 ? "Ipv6" : "Ipv4") << "\n";
+    oss << "io backend: " << (io_backend == cgo::IoBackend::Uring ? "io_uring" : "epoll") << "\n";
     oss << "socket timeout ms: " << sock_timeout_ms << "\n";
     oss << "server thread: " << svr_ctx_threads << "\n";
     oss << "client thread: " << cli_ctx_threads << "\n";
@@ -307,7 +313,7 @@ cgo::Coroutine<void> tcp_server(const Config& conf, Metric& metric) {
   std::atomic<size_t> session_wg = 0;
   std::vector<cgo::Context> session_ctx(conf.svr_ctx_threads);
   for (auto& ctx : session_ctx) {
-    ctx.startup(1);
+    ctx.startup(1, {.io_backend = conf.io_backend});
   }
 
   auto session_guard = cgo::defer([&session_ctx, &session_wg, session_num]() {
@@ -333,13 +339,17 @@ cgo::Coroutine<void> tcp_server(const Config& conf, Metric& metric) {
 void tcp_benchmark_test(Config& conf) {
   Metric svr_metric;
   cgo::Context svr_ctx;
-  svr_ctx.startup(1);
+  svr_ctx.startup(1, {.io_backend = conf.io_backend});
+  if (uring_fallback(svr_ctx, conf.io_backend)) {
+    svr_ctx.shutdown();
+    return;
+  }
   cgo::spawn(svr_ctx, tcp_server(conf, svr_metric));
 
   Metric cli_metric;
   std::vector<cgo::Context> cli_ctx(conf.cli_ctx_threads);
   for (auto& ctx : cli_ctx) {
-    ctx.startup(1);
+    ctx.startup(1, {.io_backend = conf.io_backend});
   }
   std::atomic<size_t> cli_wg = 0;
   for (int i = 0; i < conf.cli_num; ++i) {
@@ -380,6 +390,388 @@ TEST(socket, tcp_bench) {
   std::cout << "\n\n";
 }
 
+TEST(socket, tcp_bench_uring) {
+  Config conf;
+  conf.is_v6 = false;
+  conf.svr_ip = conf.is_v6 ? "::" : "0.0.0.0";
+  conf.test_duration_sec = 10;
+  conf.svr_port = 8082;
+  conf.sock_timeout_ms = 2000;
+  conf.cli_num = 1000;
+  conf.cli_interval_ms = 0;
+  conf.cli_ctx_threads = 2;
+  conf.svr_ctx_threads = 2;
+  conf.req_pkg_nbytes = 512;
+  conf.res_pgk_nbytes = 512;
+  conf.io_backend = cgo::IoBackend::Uring;
+  tcp_benchmark_test(conf);
+  std::cout << "\n\n";
+}
+
+cgo::Coroutine<void> echo_into(cgo::Socket listener, std::atomic<size_t>& wg) {
+  auto conn = co_await listener.accept();
+  if (conn) {
+    std::array<std::byte, 64> buffer;
+    while (true) {
+      auto n = co_await conn->recv_into(buffer);
+      if (!n || !(co_await conn->send(std::span<const std::byte>(buffer.data(), *n)))) {
+        break;
+      }
+    }
+    conn->close();
+  }
+  wg.fetch_add(1);
+}
+
+cgo::Coroutine<void> ping_into(uint16_t port, size_t& received, std::atomic<size_t>& wg) {
+  auto sock = cgo::Socket::create(cgo::this_coroutine_ctx(), cgo::Socket::Protocol::TCP,
+                                  cgo::Socket::AddressFamily::IPv4);
+  if (co_await sock.connect("127.0.0.1", port)) {
+    // nothing to read into is no end of the stream
+    auto empty = co_await sock.recv_into(std::span<std::byte>());
+    ASSERT(empty && *empty == 0, "");
+    auto empty_parts = co_await sock.readv({});
+    ASSERT(empty_parts && *empty_parts == 0, "");
+    // one buffer for every read
+    std::array<std::byte, 64> buffer;
+    for (int i = 0; i < 100; ++i) {
+      co_await sock.send(std::string_view("hello"));
+      size_t got = 0;
+      while (got < 5) {
+        auto n = co_await sock.recv_into(std::span(buffer).subspan(got));
+        if (!n) {
+          break;
+        }
+        got += *n;
+      }
+      received += got;
+    }
+  }
+  sock.close();
+  wg.fetch_add(1);
+}
+
+TEST(socket, recv_into) {
+  on_backends([](SocketFixture& fixture, cgo::IoBackend) {
+    auto [listener, port] = fixture.open(cgo::Socket::Protocol::TCP);
+    size_t received = 0;
+    cgo::spawn(fixture.ctx(), echo_into(listener, fixture.wg()));
+    cgo::spawn(fixture.ctx(), ping_into(port, received, fixture.wg()));
+    fixture.wait(2);
+    ASSERT(received == 500, "received=%lu", received);
+  });
+}
+
+cgo::Coroutine<void> serve_parts(cgo::Socket listener, std::atomic<size_t>& wg) {
+  auto conn = co_await listener.accept();
+  if (conn) {
+    // header, empty part and body sent as is
+    std::string_view header = "HEAD:";
+    std::string body(100000, 'x');
+    std::array<::iovec, 3> parts = {::iovec{const_cast<char*>(header.data()), header.size()}, ::iovec{nullptr, 0},
+                                    ::iovec{body.data(), body.size()}};
+    co_await conn->writev(parts);
+    conn->close();
+  }
+  wg.fetch_add(1);
+}
+
+cgo::Coroutine<void> read_parts(uint16_t port, std::string& received, std::atomic<size_t>& wg) {
+  auto sock = cgo::Socket::create(cgo::this_coroutine_ctx(), cgo::Socket::Protocol::TCP,
+                                  cgo::Socket::AddressFamily::IPv4);
+  if (co_await sock.connect("127.0.0.1", port)) {
+    std::array<char, 3> first;
+    std::array<char, 4096> second;
+    while (true) {
+      std::array<::iovec, 2> parts = {::iovec{first.data(), first.size()}, ::iovec{second.data(), second.size()}};
+      auto n = co_await sock.readv(parts);
+      if (!n) {
+        break;
+      }
+      received.append(first.data(), std::min(*n, first.size()));
+      if (*n > first.size()) {
+        received.append(second.data(), *n - first.size());
+      }
+    }
+  }
+  sock.close();
+  wg.fetch_add(1);
+}
+
+TEST(socket, writev) {
+  on_backends([](SocketFixture& fixture, cgo::IoBackend) {
+    auto [listener, port] = fixture.open(cgo::Socket::Protocol::TCP);
+    std::string received;
+    cgo::spawn(fixture.ctx(), serve_parts(listener, fixture.wg()));
+    cgo::spawn(fixture.ctx(), read_parts(port, received, fixture.wg()));
+    fixture.wait(2);
+    ASSERT(received == "HEAD:" + std::string(100000, 'x'), "received=%lu", received.size());
+  });
+}
+
+TEST(socket, send_zerocopy) {
+  const size_t msg_size = 1 << 20;
+  const size_t msg_num = 16;
+  on_backends([&](SocketFixture& fixture, cgo::IoBackend) {
+    auto [listener, port] = fixture.open(cgo::Socket::Protocol::TCP);
+    size_t received = 0;
+    cgo::spawn(fixture.ctx(), sink(listener, received, fixture.wg()));
+    cgo::spawn(fixture.ctx(), stream(port, true, msg_size, msg_num, fixture.wg()));
+    fixture.wait(2);
+    ASSERT(received == msg_size * msg_num, "received=%lu", received);
+  });
+}
+
+cgo::Coroutine<void> serve_file(cgo::Socket listener, int file_fd, size_t length, std::atomic<size_t>& wg) {
+  auto conn = co_await listener.accept();
+  if (conn) {
+    // skip the first byte of the file
+    co_await conn->send_file(file_fd, 1, length - 1);
+    conn->close();
+  }
+  wg.fetch_add(1);
+}
+
+cgo::Coroutine<void> proxy(cgo::Socket listener, uint16_t upstream_port, std::atomic<size_t>& wg) {
+  auto conn = co_await listener.accept();
+  if (conn) {
+    auto upstream = cgo::Socket::create(cgo::this_coroutine_ctx(), cgo::Socket::Protocol::TCP,
+                                        cgo::Socket::AddressFamily::IPv4);
+    if (co_await upstream.connect("127.0.0.1", upstream_port)) {
+      co_await upstream.relay(*conn);
+    }
+    upstream.close();
+    conn->close();
+  }
+  wg.fetch_add(1);
+}
+
+cgo::Coroutine<void> download(uint16_t port, std::string& received, std::atomic<size_t>& wg) {
+  auto sock = cgo::Socket::create(cgo::this_coroutine_ctx(), cgo::Socket::Protocol::TCP,
+                                  cgo::Socket::AddressFamily::IPv4);
+  if (co_await sock.connect("127.0.0.1", port)) {
+    while (true) {
+      auto data = co_await sock.recv(65536);
+      if (!data) {
+        break;
+      }
+      received += *data;
+    }
+  }
+  sock.close();
+  wg.fetch_add(1);
+}
+
+TEST(socket, send_file) {
+  std::string content(3 * 1024 * 1024 + 7, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = char('a' + i % 26);
+  }
+  auto file = ::tmpfile();
+  ::fwrite(content.data(), 1, content.size(), file);
+  ::fflush(file);
+
+  on_backends([&](SocketFixture& fixture, cgo::IoBackend) {
+    auto [origin, origin_port] = fixture.open(cgo::Socket::Protocol::TCP);
+    auto [front, front_port] = fixture.open(cgo::Socket::Protocol::TCP);
+
+    // origin --send_file--> proxy --relay--> client
+    std::string received;
+    cgo::spawn(fixture.ctx(), serve_file(origin, ::fileno(file), content.size(), fixture.wg()));
+    cgo::spawn(fixture.ctx(), proxy(front, origin_port, fixture.wg()));
+    cgo::spawn(fixture.ctx(), download(front_port, received, fixture.wg()));
+    fixture.wait(3);
+    ASSERT(received == content.substr(1), "received=%lu", received.size());
+  });
+  ::fclose(file);
+}
+
+cgo::Coroutine<void> tcp_pair(cgo::Socket listener, uint16_t port, cgo::Socket& client, cgo::Socket& server,
+                              std::atomic<size_t>& wg) {
+  client = cgo::Socket::create(cgo::this_coroutine_ctx(), cgo::Socket::Protocol::TCP,
+                               cgo::Socket::AddressFamily::IPv4);
+  co_await client.connect("127.0.0.1", port);
+  auto conn = co_await listener.accept();
+  if (conn) {
+    server = *conn;
+  }
+  wg.fetch_add(1);
+}
+
+cgo::Coroutine<void> recv_error(cgo::Socket sock, bool datagram, std::chrono::milliseconds timeout, int& err_code,
+                                std::atomic<size_t>& wg) {
+  std::array<std::byte, 64> buffer;
+  if (datagram) {
+    auto res = co_await sock.recvfrom(buffer.size(), timeout);
+    err_code = res ? 0 : res.error().err_code;
+  } else {
+    auto res = co_await sock.recv_into(buffer, timeout);
+    err_code = res ? 0 : res.error().err_code;
+  }
+  wg.fetch_add(1);
+}
+
+// holds the worker past `delay` before closing, so requests it queued are submitted along with the cancellation
+cgo::Coroutine<void> close_late(cgo::Socket sock, std::chrono::milliseconds delay) {
+  std::this_thread::sleep_for(delay);
+  sock.close();
+  co_return;
+}
+
+TEST(socket, uring_cancel) {
+  on_backends([](SocketFixture& fixture, cgo::IoBackend) {
+    auto& ctx = fixture.ctx();
+    auto [listener, port] = fixture.open(cgo::Socket::Protocol::TCP);
+    cgo::Socket client;
+    cgo::Socket server;
+    cgo::spawn(ctx, tcp_pair(listener, port, client, server, fixture.wg()));
+    // closed by the case itself
+    auto udp = cgo::Socket::create(ctx, cgo::Socket::Protocol::UDP, cgo::Socket::AddressFamily::IPv4);
+    udp.bind("127.0.0.1", 0);
+    fixture.wait(1);
+    ASSERT(server, "accept failed");
+
+    // a request ended by its link timeout, and a multishot recv waited for by a timer
+    int udp_err = 0;
+    int tcp_err = 0;
+    cgo::spawn(ctx, recv_error(udp, true, std::chrono::milliseconds(20), udp_err, fixture.wg()));
+    cgo::spawn(ctx, recv_error(server, false, std::chrono::milliseconds(20), tcp_err, fixture.wg()));
+    fixture.wait(3);
+    ASSERT(udp_err == ETIMEDOUT && tcp_err == ETIMEDOUT, "udp_err=%d, tcp_err=%d", udp_err, tcp_err);
+
+    // requests in flight end when the socket is closed, which is no timeout
+    auto begin = std::chrono::steady_clock::now();
+    cgo::spawn(ctx, recv_error(udp, true, std::chrono::seconds(10), udp_err, fixture.wg()));
+    cgo::spawn(ctx, recv_error(server, false, std::chrono::seconds(10), tcp_err, fixture.wg()));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    udp.close();
+    server.close();
+    fixture.wait(5);
+    ASSERT(std::chrono::steady_clock::now() - begin < std::chrono::seconds(5), "");
+    ASSERT(udp_err == ECANCELED && tcp_err == ECANCELED, "udp_err=%d, tcp_err=%d", udp_err, tcp_err);
+
+    // closed past the deadline, but before the timeout fired: the request is still cancelled by the close
+    auto late = cgo::Socket::create(ctx, cgo::Socket::Protocol::UDP, cgo::Socket::AddressFamily::IPv4);
+    late.bind("127.0.0.1", 0);
+    cgo::spawn(ctx, recv_error(late, true, std::chrono::milliseconds(20), udp_err, fixture.wg()));
+    cgo::spawn(ctx, close_late(late, std::chrono::milliseconds(30)));
+    fixture.wait(6);
+    ASSERT(udp_err == ECANCELED, "udp_err=%d", udp_err);
+    client.close();
+  }, {cgo::IoBackend::Uring});
+}
+
+cgo::Coroutine<void> uring_read(std::shared_ptr<cgo::_impl::UringSocket> sock, size_t size, std::string& received,
+                                std::atomic<size_t>& wg) {
+  auto& ctx = cgo::this_coroutine_ctx();
+  std::array<char, 4096> buffer;
+  while (received.size() < size) {
+    ::iovec iov = {buffer.data(), std::min(buffer.size(), size - received.size())};
+    int n = co_await sock->recv(ctx, *cgo::_impl::UringContext::at(ctx), std::span(&iov, 1), std::chrono::seconds(5),
+                                {});
+    if (n <= 0) {
+      break;
+    }
+    received.append(buffer.data(), n);
+  }
+  wg.fetch_add(1);
+}
+
+std::string pattern(size_t begin, size_t end) {
+  std::string data(end - begin, '\0');
+  for (size_t i = begin; i < end; ++i) {
+    data[i - begin] = char('a' + i % 26);
+  }
+  return data;
+}
+
+TEST(socket, uring_buffers) {
+  using cgo::_impl::Uring;
+  using cgo::_impl::UringSocket;
+  cgo::Context ctx;
+  ctx.startup(1, {.io_backend = cgo::IoBackend::Uring});
+  if (uring_fallback(ctx, cgo::IoBackend::Uring)) {
+    ctx.shutdown();
+    return;
+  }
+
+  struct Peer {
+    int fds[2];
+    std::shared_ptr<UringSocket> sock;
+    size_t sent = 0;
+  };
+  auto connect = [&ctx](Peer& peer) {
+    ASSERT(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, peer.fds) == 0, "");
+    peer.sock = std::make_shared<UringSocket>(peer.fds[0]);
+    // the first read arms the multishot recv
+    peer.sent = ::write(peer.fds[1], "a", 1);
+    std::atomic<size_t> wg = 0;
+    std::string received;
+    cgo::spawn(ctx, uring_read(peer.sock, 1, received, wg));
+    while (wg.load() < 1) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT(received == "a", "");
+  };
+
+  // peers nobody reads are paused at `MaxChunks` buffers each, until every provided buffer is held
+  std::vector<Peer> peers;
+  size_t held = 0;
+  while (peers.size() < 2 * Uring::BufferNum / UringSocket::MaxChunks && held < Uring::BufferNum) {
+    auto& peer = peers.emplace_back();
+    connect(peer);
+    while (true) {
+      auto data = pattern(peer.sent, peer.sent + 4096);
+      auto n = ::write(peer.fds[1], data.data(), data.size());
+      if (n <= 0) {
+        break;
+      }
+      peer.sent += n;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT(peer.sock->held() < Uring::BufferNum / 4, "held=%lu", peer.sock->held());
+    held += peer.sock->held();
+  }
+  ASSERT(held == Uring::BufferNum, "held=%lu", held);
+
+  // with no buffer left, a read receives into the caller's buffer
+  Peer starved;
+  connect(starved);
+  auto data = pattern(1, 1001);
+  starved.sent += ::write(starved.fds[1], data.data(), data.size());
+  std::atomic<size_t> wg = 0;
+  std::string received;
+  cgo::spawn(ctx, uring_read(starved.sock, data.size(), received, wg));
+  while (wg.load() < 1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT(received == data, "received=%lu", received.size());
+  ASSERT(starved.sock->held() == 0, "");
+
+  // paused peers are armed again once read, nothing is lost or reordered
+  std::vector<std::string> receiveds(peers.size());
+  for (size_t i = 0; i < peers.size(); ++i) {
+    receiveds[i] = "a";
+    cgo::spawn(ctx, uring_read(peers[i].sock, peers[i].sent, receiveds[i], wg));
+  }
+  while (wg.load() < 1 + peers.size()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  for (size_t i = 0; i < peers.size(); ++i) {
+    ASSERT(receiveds[i] == pattern(0, peers[i].sent), "peer=%lu, received=%lu, sent=%lu", i, receiveds[i].size(),
+           peers[i].sent);
+  }
+  peers.push_back(starved);
+  for (auto& peer : peers) {
+    cgo::_impl::UringContext::at(ctx)->cancel(peer.fds[0]);
+  }
+  ctx.shutdown();
+  for (auto& peer : peers) {
+    ::close(peer.fds[0]);
+    ::close(peer.fds[1]);
+  }
+}
+
 cgo::Coroutine<void> udp_client(const Config& conf, Metric& metric, std::atomic<size_t>& wg) {
   auto& ctx = cgo::this_coroutine_ctx();
   auto sock = cgo::Socket::create(ctx, cgo::Socket::Protocol::UDP,
@@ -564,6 +956,35 @@ void udp_benchmark_test(Config& conf) {
   std::cout << cli_metric.str();
 }
 
+TEST(socket, udp_batch) {
+  const size_t rounds = 200;
+  on_backends([&](SocketFixture& fixture, cgo::IoBackend) {
+    auto [server, port] = fixture.open(cgo::Socket::Protocol::UDP);
+    auto [client, _] = fixture.open(cgo::Socket::Protocol::UDP);
+    size_t received = 0;
+    cgo::spawn(fixture.ctx(), batch_echo(server, rounds * 32, fixture.wg()));
+    cgo::spawn(fixture.ctx(), batch_ping(client, port, rounds, received, fixture.wg()));
+    fixture.wait(2);
+    ASSERT(received == rounds * 32, "received=%lu", received);
+  });
+}
+
+TEST(socket, udp_gso) {
+  const size_t segment_size = 1000;
+  const size_t per_round = 64;
+  const size_t rounds = 200;
+  on_backends([&](SocketFixture& fixture, cgo::IoBackend) {
+    auto [server, port] = fixture.open(cgo::Socket::Protocol::UDP);
+    ASSERT(server.set_gro(true), "set_gro failed");
+    auto [client, _] = fixture.open(cgo::Socket::Protocol::UDP);
+    size_t received = 0;
+    cgo::spawn(fixture.ctx(), gro_sink(server, per_round, rounds, received, fixture.wg()));
+    cgo::spawn(fixture.ctx(), gso_source(client, port, true, segment_size, per_round, rounds, fixture.wg()));
+    fixture.wait(2);
+    ASSERT(received == per_round * rounds, "received=%lu", received);
+  }, {cgo::IoBackend::Epoll});
+}
+
 TEST(socket, udp_bench) {
   Config conf;
   conf.is_v6 = true;
@@ -0,0 +1,53 @@
+#include "core/spinlock.h"
+
+#include <mutex>
+#include <thread>
+
+#include "mtest.h"
+
+const size_t exec_num = 4;
+const size_t foo_loop = 100000;
+
+TEST(spinlock, mutual_exclusion) {
+  cgo::_impl::Spinlock mtx;
+  size_t counter = 0;
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < exec_num; ++i) {
+    workers.emplace_back([&mtx, &counter]() {
+      for (size_t j = 0; j < foo_loop; ++j) {
+        std::unique_lock guard(mtx);
+        ++counter;
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  ASSERT(counter == exec_num * foo_loop, "counter=%lu", counter);
+  ASSERT(mtx.try_lock(), "");
+  ASSERT(!mtx.try_lock(), "");
+  mtx.unlock();
+}
+
+TEST(spinlock, stats) {
+  if (!cgo::_impl::Spinlock::StatsEnabled) {
+    ASSERT(cgo::_impl::Spinlock::stats().empty(), "");
+    return;
+  }
+  auto find = [](const void* lock) {
+    for (auto& s : cgo::_impl::Spinlock::stats()) {
+      if (s.lock == lock) {
+        return s;
+      }
+    }
+    return cgo::_impl::Spinlock::Stats{};
+  };
+  cgo::_impl::Spinlock mtx("test");
+  for (size_t i = 0; i < foo_loop; ++i) {
+    std::unique_lock guard(mtx);
+  }
+  auto s = find(&mtx);
+  ASSERT(s.acquisitions == foo_loop, "acquisitions=%lu", s.acquisitions);
+  ASSERT(std::string_view(s.name) == "test", "");
+  cgo::_impl::Spinlock::dump_stats(stdout);
+}
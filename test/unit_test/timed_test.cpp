@@ -1,5 +1,7 @@
 #include "core/timed.h"
 
+#include <unistd.h>
+
 #include "core/channel.h"
 #include "core/context.h"
 #include "mtest.h"
@@ -88,4 +90,241 @@ TEST(timed, ctx_stop) {
     std::this_thread::sleep_for(std::chrono::milliseconds(50));
   }
   ctx.shutdown();
-}
\ No newline at end of file
+}
+
+TEST(timed, wheel_sleep) {
+  std::atomic<size_t> end_num = 0;
+  std::atomic<size_t> early_num = 0;
+  cgo::Context ctx;
+  ctx.startup(exec_num, {.timer_backend = cgo::TimerBackend::Wheel});
+  for (int i = 0; i < foo_num / 10; ++i) {
+    auto ms = std::chrono::milliseconds(std::rand() % 50 + 1);
+    cgo::spawn(ctx, [](auto ms, std::atomic<size_t>& end_num, std::atomic<size_t>& early_num) -> cgo::Coroutine<void> {
+      for (int i = 0; i < 5; ++i) {
+        auto begin = std::chrono::steady_clock::now();
+        co_await cgo::sleep(cgo::this_coroutine_ctx(), ms);
+        if (std::chrono::steady_clock::now() - begin < ms) {
+          early_num.fetch_add(1);
+        }
+      }
+      end_num.fetch_add(1);
+    }(ms, end_num, early_num));
+  }
+  while (end_num < foo_num / 10) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  ctx.shutdown();
+  ASSERT(early_num == 0, "early_num=%lu", early_num.load());
+}
+
+TEST(timed, cancel) {
+  for (auto backend : {cgo::TimerBackend::Heap, cgo::TimerBackend::Wheel}) {
+    cgo::_impl::TimedContext timed(1, backend);
+    size_t fired = 0;
+    std::vector<cgo::_impl::TimedContext::Handle> handles;
+    for (size_t i = 0; i < 1000; ++i) {
+      handles.push_back(timed.create_timeout([&fired]() { ++fired; }, std::chrono::milliseconds(i % 10)));
+    }
+    for (size_t i = 0; i < handles.size(); i += 2) {
+      ASSERT(handles[i].cancel(), "");
+      ASSERT(!handles[i].cancel(), "cancelled twice");
+    }
+    ASSERT(timed.size() == 500, "size=%lu", timed.size());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    while (timed.run_timeout(0, 1024) > 0) {
+    }
+    ASSERT(fired == 500, "fired=%lu", fired);
+    ASSERT(timed.size() == 0, "");
+    for (size_t i = 1; i < handles.size(); i += 2) {
+      ASSERT(!handles[i].cancel(), "fired timer cancelled");
+    }
+  }
+}
+
+TEST(timed, cancel_in_batch) {
+  for (auto backend : {cgo::TimerBackend::Heap, cgo::TimerBackend::Wheel}) {
+    cgo::_impl::TimedContext timed(1, backend);
+    size_t fired = 0;
+    cgo::_impl::TimedContext::Handle first;
+    cgo::_impl::TimedContext::Handle second;
+    // whichever fires first cancels the other, both expire in one batch
+    first = timed.create_timeout([&]() { fired += second.cancel() ? 1 : 100; }, std::chrono::milliseconds(1));
+    second = timed.create_timeout([&]() { fired += first.cancel() ? 1 : 100; }, std::chrono::milliseconds(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ASSERT(timed.run_timeout(0, 1024) == 2, "");
+    ASSERT(fired == 1, "fired=%lu", fired);
+    ASSERT(timed.size() == 0, "size=%lu", timed.size());
+  }
+}
+
+TEST(timed, select_timeout) {
+  std::atomic<size_t> end_num = 0;
+  cgo::Context ctx;
+  ctx.startup(exec_num);
+  for (int i = 0; i < foo_num / 10; ++i) {
+    cgo::spawn(ctx, [](std::atomic<size_t>& end_num) -> cgo::Coroutine<void> {
+      auto& ctx = cgo::this_coroutine_ctx();
+      cgo::Channel<int> chan(1);
+      for (int i = 0; i < 10; ++i) {
+        chan.nowait() << i;
+        cgo::Select select;
+        select.on(1, chan) >> cgo::Dropout{};
+        select.on(2, cgo::Select::Timeout{std::chrono::seconds(60)});
+        ASSERT(co_await select() == 1, "");
+      }
+      cgo::Select select;
+      select.on(1, chan) >> cgo::Dropout{};
+      select.on(2, cgo::Select::Timeout{std::chrono::milliseconds(5)});
+      ASSERT(co_await select() == 2, "");
+      end_num.fetch_add(1);
+    }(end_num));
+  }
+  while (end_num < foo_num / 10) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  // timers of completed selects are removed instead of lingering until their deadline
+  ASSERT(cgo::_impl::TimedContext::at(ctx).size() == 0, "size=%lu", cgo::_impl::TimedContext::at(ctx).size());
+  ctx.shutdown();
+}
+
+size_t timer_deadlines(std::chrono::milliseconds slack, size_t& early_num) {
+  cgo::_impl::TimedContext timed(1);
+  size_t fired = 0;
+  for (size_t i = 0; i < 1000; ++i) {
+    auto timeout = std::chrono::microseconds(std::rand() % 20000);
+    auto ex = std::chrono::steady_clock::now() + timeout;
+    timed.create_timeout(
+        [ex, &fired, &early_num]() {
+          ++fired;
+          if (std::chrono::steady_clock::now() < ex) {
+            ++early_num;
+          }
+        },
+        timeout, slack);
+  }
+  size_t deadlines = 0;
+  while (fired < 1000) {
+    std::this_thread::sleep_until(timed.next_schedule_time(0));
+    timed.run_timeout(0, 1024);
+    ++deadlines;
+  }
+  return deadlines;
+}
+
+TEST(timed, slack) {
+  size_t early_num = 0;
+  size_t exact = timer_deadlines(std::chrono::milliseconds(0), early_num);
+  size_t coalesced = timer_deadlines(std::chrono::milliseconds(5), early_num);
+  printf("wakeups to expire 1000 timers within 20ms: exact %lu, 5ms slack %lu\n", exact, coalesced);
+  ASSERT(coalesced <= 6, "coalesced=%lu", coalesced);
+  ASSERT(early_num == 0, "early_num=%lu", early_num);
+}
+
+TEST(timed, precise_wakeup) {
+  const size_t sleep_num = 200;
+  const auto timeout = std::chrono::microseconds(200);
+
+  int fds[2];
+  ASSERT(::pipe(fds) == 0, "");
+  std::atomic<bool> end = false;
+  std::chrono::nanoseconds late = {};
+  cgo::Context ctx;
+  ctx.startup(1);
+  // with an fd registered the idle worker waits in epoll rather than on its futex
+  cgo::_impl::EventContext::at(ctx).add(fds[0], cgo::_impl::Event::IN, [](cgo::_impl::Event) {});
+  cgo::spawn(ctx, [](auto timeout, std::chrono::nanoseconds& late, std::atomic<bool>& end) -> cgo::Coroutine<void> {
+    for (size_t i = 0; i < sleep_num; ++i) {
+      auto begin = std::chrono::steady_clock::now();
+      co_await cgo::sleep(cgo::this_coroutine_ctx(), timeout);
+      late += std::chrono::steady_clock::now() - begin - timeout;
+    }
+    end = true;
+  }(timeout, late, end));
+  while (!end) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  cgo::_impl::EventContext::at(ctx).del(fds[0]);
+  ctx.shutdown();
+  ::close(fds[0]);
+  ::close(fds[1]);
+
+  auto mean_us = std::chrono::duration<double, std::micro>(late).count() / sleep_num;
+  printf("mean lateness of a %ldus sleep while polling: %.0fus\n", timeout.count(), mean_us);
+  ASSERT(mean_us < 500, "mean_us=%.0f", mean_us);
+}
+
+const size_t ticker_num = 1000;
+const size_t tick_num = 20;
+
+TEST(timed, ticker) {
+  const auto period = std::chrono::milliseconds(5);
+
+  std::atomic<size_t> end_num = 0;
+  std::atomic<size_t> late_num = 0;
+  cgo::Context ctx;
+  ctx.startup(exec_num);
+  for (size_t i = 0; i < ticker_num; ++i) {
+    cgo::spawn(ctx, [](auto period, std::atomic<size_t>& end_num, std::atomic<size_t>& late_num) -> cgo::Coroutine<void> {
+      cgo::Ticker ticker(cgo::this_coroutine_ctx(), period);
+      auto begin = std::chrono::steady_clock::now();
+      cgo::Ticker::TimePoint tp;
+      for (size_t i = 0; i < tick_num; ++i) {
+        co_await (ticker.chan() >> tp);
+      }
+      // ticks are scheduled from the previous deadline, the time spent in between does not add up
+      if (std::chrono::steady_clock::now() - begin > period * tick_num + std::chrono::milliseconds(50)) {
+        late_num.fetch_add(1);
+      }
+      ticker.stop();
+      end_num.fetch_add(1);
+    }(period, end_num, late_num));
+  }
+  while (end_num < ticker_num) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT(cgo::_impl::TimedContext::at(ctx).size() == 0, "size=%lu", cgo::_impl::TimedContext::at(ctx).size());
+  ctx.shutdown();
+  ASSERT(late_num == 0, "late_num=%lu", late_num.load());
+}
+
+TEST(timed, ticker_at_shutdown) {
+  std::atomic<size_t> started = 0;
+  {
+    cgo::Context ctx;
+    ctx.startup(1);
+    for (size_t i = 0; i < 10; ++i) {
+      // never suspended on a condition, so the frame is left to the context destructor
+      cgo::spawn(ctx, [](std::atomic<size_t>& started) -> cgo::Coroutine<void> {
+        cgo::Ticker ticker(cgo::this_coroutine_ctx(), std::chrono::milliseconds(1));
+        started.fetch_add(1);
+        while (true) {
+          co_await cgo::yield();
+        }
+      }(started));
+    }
+    while (started < 10) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ctx.shutdown();
+  }
+}
+
+TEST(timed, periodic_cancel) {
+  for (auto backend : {cgo::TimerBackend::Heap, cgo::TimerBackend::Wheel}) {
+    cgo::_impl::TimedContext timed(1, backend);
+    size_t fired = 0;
+    auto handle = timed.create_periodic([&fired]() { ++fired; }, std::chrono::milliseconds(1));
+    cgo::_impl::TimedContext::Handle self;
+    self = timed.create_periodic(
+        [&self]() { ASSERT(self.cancel(), "periodic timer stops itself"); }, std::chrono::milliseconds(1));
+    while (fired < 10) {
+      timed.run_timeout(0, 1024);
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    // one timer entry per periodic timer, re-armed in place
+    ASSERT(timed.size() == 1, "size=%lu", timed.size());
+    ASSERT(handle.cancel(), "");
+    ASSERT(timed.size() == 0, "");
+  }
+}